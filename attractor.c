@@ -0,0 +1,4 @@
+// builds attractor.h as a library, see build.sh / build.bat
+
+#define ATTRACTOR_IMPLEMENTATION
+#include "attractor.h"
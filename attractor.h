@@ -0,0 +1,1042 @@
+// strange attractor search and rendering as a library, include this header
+// wherever it is used and define ATTRACTOR_IMPLEMENTATION in one file
+//
+// nothing here reads the command line, a context is read only once it has
+// been created so threads can share one, and images are written into
+// buffers the caller owns
+
+#ifndef ATTRACTOR_H
+#define ATTRACTOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+enum colour_type {
+	INF,
+	BLA,
+	VID,
+	ICE,
+	BW,
+	HSV,
+	HSL,
+	RGB,
+	MIX,
+	COLOUR_COUNT,
+};
+
+enum attractor_type {
+	AT_POLY,
+	AT_TRIG,
+	AT_SAW,
+	AT_TRI,
+	AT_COUNT,
+};
+
+// longest line of a parameter file
+#define PARAMS_LEN 1024
+
+typedef double coef[8][2];
+typedef double vec[2];
+
+struct config {
+	enum attractor_type type;
+	coef c;
+	vec x_min, x_max, v_max;
+	vec seed;	// a point already on the attractor, valid if seeded
+	bool seeded;
+	double lyapunov;
+	double score;
+	enum colour_type colour;
+};
+
+// how to draw a config, each render can have its own
+struct render_settings {
+	int width, height;
+	int downscale;
+	int quality;	// iterations per pixel
+	double intensity;
+	double border;
+	bool light;
+	bool stretch;
+};
+
+// tables shared by every render, see attractor_create()
+struct attractor_context;
+
+struct attractor_context *attractor_create(void);
+void attractor_destroy(struct attractor_context *context);
+
+// 6 coefficients per axis for POLY, 8 for the rest
+int attractor_coef_count(enum attractor_type type);
+
+// fill in the bounds, seed and score of conf->c, false if it isn't chaotic
+bool attractor_validate(struct config *conf);
+
+// draw coefficients of conf->type uniformly until one is valid, seed is the
+// caller's random state so threads don't share one
+void attractor_search(struct config *conf, unsigned *seed);
+
+// read a params line, fields the line doesn't give keep their value. rs may
+// be NULL, then size and quality overrides are rejected
+bool attractor_parse(struct config *conf, struct render_settings *rs, const char *line);
+void attractor_format(struct config *conf, char params[PARAMS_LEN]);
+
+// draw conf into rgb, which holds rs->width * rs->height * 3 bytes
+void attractor_render(const struct attractor_context *context, const struct render_settings *rs,
+                      struct config *conf, unsigned char *rgb);
+
+// attractor_render() for consecutive frames of a video, which barely change.
+// if conf isn't seeded and carry is set, the orbit goes on from where the
+// previous frame left it in orbit after a short settle instead of starting
+// over. orbit is left where this frame ended
+void attractor_render_from(const struct attractor_context *context, const struct render_settings *rs,
+                           struct config *conf, unsigned char *rgb, vec orbit, bool carry);
+
+// attractor_render() for up to ATTRACTOR_LANES frames of the same type and
+// size, with their orbits iterated side by side. frames after the first that
+// aren't seeded carry on from where the frame before started
+#define ATTRACTOR_LANES 8
+void attractor_render_lanes(const struct attractor_context *context, const struct render_settings *rs,
+                            struct config *confs, int count, unsigned char *rgb[]);
+
+// encode an image as png into out, returns the length of the png or 0 if it
+// didn't fit. size attractor_png_bound() is always enough
+size_t attractor_png_bound(int width, int height);
+size_t attractor_encode_png(const unsigned char *rgb, int width, int height, unsigned char *out, size_t size);
+
+// encode an image as jpeg with quality between 1 and 100, the same way. only
+// noise at the highest qualities takes more than attractor_jpg_bound()
+size_t attractor_jpg_bound(int width, int height);
+size_t attractor_encode_jpg(const unsigned char *rgb, int width, int height, int quality,
+                            unsigned char *out, size_t size);
+
+#endif
+
+#if defined(ATTRACTOR_IMPLEMENTATION) && !defined(ATTRACTOR_IMPLEMENTED)
+#define ATTRACTOR_IMPLEMENTED
+
+#define _USE_MATH_DEFINES
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#define STB_IMAGE_RESIZE_STATIC
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "stb_image_resize2.h"
+
+#include "gradient.h"
+
+#ifndef MAX
+#define MAX(x, y)	((x) > (y) ? (x) : (y))
+#define MIN(x, y)	((x) < (y) ? (x) : (y))
+#define LENGTH(a)	(sizeof(a) / sizeof(a[0]))
+#endif
+#define M_SQRT3 1.73205080756887729352744634151
+
+static char *colour_map[] = {
+	[INF] = "INF",
+	[BLA] = "BLA",
+	[VID] = "VID",
+	[ICE] = "ICE",
+	[BW] = "BW",
+	[HSV] = "HSV",
+	[HSL] = "HSL",
+	[RGB] = "RGB",
+	[MIX] = "MIX",
+};
+
+static char *attractor_map[] = {
+	[AT_POLY] = "POLY",
+	[AT_TRIG] = "TRIG",
+	[AT_SAW] = "SAW",
+	[AT_TRI] = "TRI",
+};
+
+struct attractor_context {
+	double gradients[NUM_GRADIENTS][GN][3];
+};
+
+static const long long unsigned CUTOFF = 10000;
+static const long long unsigned SETTLE = CUTOFF / 16;	// to carry an orbit onto a nearby attractor
+static const double CYCLE_EPSILON = 1e-9;
+
+int attractor_coef_count(enum attractor_type type)
+{
+	return type == AT_POLY ? 6 : 8;
+}
+
+static vec u[3] = {
+	{1, 0},
+	{-1.0 / 2, M_SQRT3 / 2},
+	{-1.0 / 2, -M_SQRT3 / 2},
+};
+
+static double dot(vec x, vec y)
+{
+	double s = 0;
+	for (int i = 0; i < 2; ++i)
+		s += x[i] * y[i];
+	return s;
+}
+
+static double dst(vec x0, vec x1)
+{
+	double s = 0;
+	for (int i = 0; i < 2; ++i) {
+		double d = x1[i] - x0[i];
+		s += d * d;
+	}
+	return sqrt(s);
+}
+
+static double mag(vec x)
+{
+	double d = dot(x, x);
+	return sqrt(d);
+}
+
+static double triangle(double x)
+{
+	return 1 - 4 * fabs(x - floor(x + 0.5));
+}
+
+static double saw(double x)
+{
+	return 1 - 2 * (x - floor(x));
+}
+
+static void iteration(enum attractor_type type, coef c, vec y)
+{
+#if 1
+	vec z;
+	for (int i = 0; i < 2; ++i)
+		switch (type) {
+			case AT_POLY:
+				z[i] =
+					c[0][i] +
+					c[1][i] * y[0] +
+					c[2][i] * y[0] * y[0] +
+					c[3][i] * y[0] * y[1] +
+					c[4][i] * y[1] * y[1] +
+					c[5][i] * y[1];
+				break;
+			case AT_TRIG:
+				z[i] =
+					c[0][i] * sin(c[1][i] * y[1]) +
+					c[2][i] * cos(c[3][i] * y[0]) +
+					c[4][i] * sin(c[5][i] * y[0]) +
+					c[6][i] * cos(c[7][i] * y[1]);
+				break;
+			case AT_SAW:
+				z[i] =
+					c[0][i] * saw(c[1][i] * y[1]) +
+					c[2][i] * saw(c[3][i] * y[0] + 0.5) +
+					c[4][i] * saw(c[5][i] * y[0]) +
+					c[6][i] * saw(c[7][i] * y[1] + 0.5);
+				break;
+			case AT_TRI:
+				z[i] =
+					c[0][i] * triangle(c[1][i] * y[1]) +
+					c[2][i] * triangle(c[3][i] * y[0] + 0.5) +
+					c[4][i] * triangle(c[5][i] * y[0]) +
+					c[6][i] * triangle(c[7][i] * y[1] + 0.5);
+				break;
+			default:
+				assert(0);
+		}
+#else
+#define Y(i) (i < 2 ? y[i] : 1)
+	vec z = {0, 0};
+	for (int i = 0; i < 2; ++i) {
+		int a = 0;
+		for (int j = 0; j < 2 + 1; ++j)
+			for (int k = j; k < 2 + 1; ++k)
+				z[i] += c[a++][i] * Y(j) * Y(k);
+	}
+#endif
+	for (int i = 0; i < 2; ++i)
+		y[i] = z[i];
+}
+
+#define QUALITY_SAMPLES 2048
+
+// cheap estimate of how interesting an attractor will look, from a
+// subsample of its orbit: the box counting dimension (1 for thin lines, 2
+// for filled regions) times how much of a 64x64 grid it covers times the
+// square root of the ratio of its sides, giving a score between 0 and 1
+static double quality(struct config *conf, vec *points, int count)
+{
+	static const int sizes[] = {4, 8, 16, 32, 64};
+	int boxes[LENGTH(sizes)];
+	for (int s = 0; s < LENGTH(sizes); ++s) {
+		int n = sizes[s];
+		unsigned char occupied[64 * 64] = {0};
+		boxes[s] = 0;
+		for (int p = 0; p < count; ++p) {
+			int b[2];
+			for (int i = 0; i < 2; ++i) {
+				double t = (points[p][i] - conf->x_min[i]) / (conf->x_max[i] - conf->x_min[i]);
+				b[i] = MIN(n - 1, MAX(0, (int)(t * n)));
+			}
+			boxes[s] += !occupied[b[0] * n + b[1]];
+			occupied[b[0] * n + b[1]] = 1;
+		}
+	}
+
+	// least squares slope of log(boxes) against log(size), leaving out the
+	// finest grid which the subsample is too sparse to fill
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	int m = LENGTH(sizes) - 1;
+	for (int s = 0; s < m; ++s) {
+		double lx = log(sizes[s]), ly = log(boxes[s]);
+		sx += lx, sy += ly, sxx += lx * lx, sxy += lx * ly;
+	}
+	double dimension = (m * sxy - sx * sy) / (m * sxx - sx * sx);
+	double occupancy = (double)boxes[m] / MIN(count, 64 * 64);
+	double range[2] = {conf->x_max[0] - conf->x_min[0], conf->x_max[1] - conf->x_min[1]};
+	double aspect = MIN(range[0], range[1]) / MAX(range[0], range[1]);
+	return MIN(1, MAX(0, dimension / 2)) * occupancy * sqrt(aspect);
+}
+
+// number of orbits iterated together, laid out so the compiler can
+// vectorise each step across the lanes
+#define LANES ATTRACTOR_LANES
+
+typedef double coef_lanes[8][2][LANES];
+typedef double vec_lanes[2][LANES];
+
+// iteration() for the first lanes orbits
+static void iteration_lanes(enum attractor_type type, coef_lanes c, vec_lanes y, int lanes)
+{
+	vec_lanes z;
+	for (int i = 0; i < 2; ++i)
+		switch (type) {
+			case AT_POLY:
+				for (int l = 0; l < lanes; ++l)
+					z[i][l] =
+						c[0][i][l] +
+						c[1][i][l] * y[0][l] +
+						c[2][i][l] * y[0][l] * y[0][l] +
+						c[3][i][l] * y[0][l] * y[1][l] +
+						c[4][i][l] * y[1][l] * y[1][l] +
+						c[5][i][l] * y[1][l];
+				break;
+			case AT_TRIG:
+				for (int l = 0; l < lanes; ++l)
+					z[i][l] =
+						c[0][i][l] * sin(c[1][i][l] * y[1][l]) +
+						c[2][i][l] * cos(c[3][i][l] * y[0][l]) +
+						c[4][i][l] * sin(c[5][i][l] * y[0][l]) +
+						c[6][i][l] * cos(c[7][i][l] * y[1][l]);
+				break;
+			case AT_SAW:
+				for (int l = 0; l < lanes; ++l)
+					z[i][l] =
+						c[0][i][l] * saw(c[1][i][l] * y[1][l]) +
+						c[2][i][l] * saw(c[3][i][l] * y[0][l] + 0.5) +
+						c[4][i][l] * saw(c[5][i][l] * y[0][l]) +
+						c[6][i][l] * saw(c[7][i][l] * y[1][l] + 0.5);
+				break;
+			case AT_TRI:
+				for (int l = 0; l < lanes; ++l)
+					z[i][l] =
+						c[0][i][l] * triangle(c[1][i][l] * y[1][l]) +
+						c[2][i][l] * triangle(c[3][i][l] * y[0][l] + 0.5) +
+						c[4][i][l] * triangle(c[5][i][l] * y[0][l]) +
+						c[6][i][l] * triangle(c[7][i][l] * y[1][l] + 0.5);
+				break;
+			default:
+				assert(0);
+		}
+	memcpy(y, z, sizeof(vec_lanes));
+}
+
+// find a set of coefficients to generate a strange attractor
+bool attractor_validate(struct config *conf)
+{
+	// initialize parameters
+	vec x = {0};
+	vec xe = {1e-3};	// for lyapunov exponent
+	double d0 = dst(x, xe);
+	vec v;
+
+	for (int i = 0; i < 2; ++i) {
+		conf->x_min[i] = 1e10;
+		conf->x_max[i] = -1e10;
+		conf->v_max[i] = 0;
+	}
+	conf->seeded = false;
+
+	// brent's cycle detection, x_cycle is the tortoise which jumps to x every
+	// power of two steps, so a periodic orbit is caught soon after its transient
+	vec x_cycle = {0};
+	unsigned power = 1, lambda = 0;
+
+	vec points[QUALITY_SAMPLES];
+	int count = 0;
+	unsigned stride = MAX(1, (unsigned)(CUTOFF / QUALITY_SAMPLES));
+
+	double lyapunov = 0;
+	for (unsigned n = 0; n < CUTOFF * 2; ++n) {
+		vec x_last;
+		for (int i = 0; i < 2; ++i)
+			x_last[i] = x[i];
+
+		iteration(conf->type, conf->c, x);
+		iteration(conf->type, conf->c, xe);
+
+		// converge, diverge
+		for (int i = 0; i < 2; ++i)
+			if (fabs(x[i]) > 1e10 || fabs(x[i]) < 1e-10)
+				return false;
+
+		// periodic orbit
+		if (dst(x, x_cycle) < CYCLE_EPSILON * (1 + mag(x)))
+			return false;
+		if (++lambda == power) {
+			memcpy(x_cycle, x, sizeof(vec));
+			power *= 2;
+			lambda = 0;
+		}
+		if (n > CUTOFF) {
+			for (int i = 0; i < 2; ++i) {
+				v[i] = x[i] - x_last[i];
+				conf->x_max[i] = MAX(conf->x_max[i], x[i]);
+				conf->x_min[i] = MIN(conf->x_min[i], x[i]);
+				conf->v_max[i] = MAX(fabs(v[i]), conf->v_max[i]);
+			}
+			// lyapunov exponent
+			double d = dst(x, xe);
+			lyapunov += log(fabs(d / d0));
+
+			if (n % stride == 0 && count < QUALITY_SAMPLES)
+				memcpy(points[count++], x, sizeof(vec));
+		}
+	}
+	conf->lyapunov = lyapunov / CUTOFF;
+	if (!(conf->lyapunov > 5))
+		return false;
+	memcpy(conf->seed, x, sizeof(vec));
+	conf->seeded = true;
+	conf->score = quality(conf, points, count);
+	return true;
+}
+
+// start an orbit on the attractor, from the point validation finished on if
+// there is one, otherwise by iterating away the transient from the origin
+static void start_orbit(struct config *conf, vec x)
+{
+	if (conf->seeded) {
+		memcpy(x, conf->seed, sizeof(vec));
+		return;
+	}
+	for (unsigned n = 0; n < CUTOFF; ++n)
+		iteration(conf->type, conf->c, x);
+}
+
+// "v2 <type> <coefficients> <x_min> <x_max> <v_max> <seed> <lyapunov> <score>"
+// with every number as a hex float, so a config reads back bit for bit
+// without validating it again
+static bool set_exact_config(struct config *conf, const char *params)
+{
+	char type[16];
+	int n;
+	if (sscanf(params, "v2 %15s%n", type, &n) < 1)
+		return false;
+	int t;
+	for (t = 0; t < AT_COUNT; ++t)
+		if (0 == strcmp(type, attractor_map[t]))
+			break;
+	if (t == AT_COUNT)
+		return false;
+	conf->type = t;
+
+	double *fields[2 * 8 + 4 * 2 + 2];
+	int count = 0;
+	for (int i = 0; i < 2; ++i)
+		for (int j = 0; j < attractor_coef_count(conf->type); ++j)
+			fields[count++] = &conf->c[j][i];
+	double *vecs[] = {conf->x_min, conf->x_max, conf->v_max, conf->seed};
+	for (int k = 0; k < LENGTH(vecs); ++k)
+		for (int i = 0; i < 2; ++i)
+			fields[count++] = &vecs[k][i];
+	fields[count++] = &conf->lyapunov;
+	fields[count++] = &conf->score;
+
+	const char *p = params + n;
+	for (int k = 0; k < count; ++k) {
+		char *end;
+		*fields[k] = strtod(p, &end);
+		if (end == p)
+			return false;
+		p = end;
+	}
+	conf->seeded = true;
+	return true;
+}
+
+static int find_name(char **map, int count, const char *name)
+{
+	for (int i = 0; i < count; ++i)
+		if (map[i] && 0 == strcmp(map[i], name))
+			return i;
+	return -1;
+}
+
+// a params line can end with "-width N -height N -quality N -colour C -type T"
+// to render that line differently from the command line, the overrides are
+// cut off the line. rs is NULL where the size can't change per line
+static bool set_overrides(struct config *conf, struct render_settings *rs, char *params)
+{
+	static const char *names[] = {" -width ", " -height ", " -quality ", " -colour ", " -type "};
+	char *start = NULL;
+	for (int k = 0; k < LENGTH(names); ++k) {
+		char *found = strstr(params, names[k]);
+		if (found && (!start || found < start))
+			start = found;
+	}
+	if (!start)
+		return true;
+
+	char name[16], val[32];
+	int n;
+	const char *p = start;
+	while (2 == sscanf(p, "%15s %31s%n", name, val, &n)) {
+		p += n;
+		if (0 == strcmp(name, "-type")) {
+			int t = find_name(attractor_map, AT_COUNT, val);
+			if (t < 0)
+				return false;
+			conf->type = t;
+		} else if (0 == strcmp(name, "-colour")) {
+			int c = find_name(colour_map, COLOUR_COUNT, val);
+			if (c < 0)
+				return false;
+			conf->colour = c;
+		} else {
+			int *field = !rs ? NULL
+				: 0 == strcmp(name, "-width") ? &rs->width
+				: 0 == strcmp(name, "-height") ? &rs->height
+				: 0 == strcmp(name, "-quality") ? &rs->quality
+				: NULL;
+			char *end;
+			long i = strtol(val, &end, 10);
+			if (!field || *end != '\0' || i < 1 || i > 1 << 16)
+				return false;
+			*field = (int)i;
+		}
+	}
+	if (strspn(p, " \t\r\n") != strlen(p))
+		return false;
+	*start = '\0';
+	return true;
+}
+
+bool attractor_parse(struct config *conf, struct render_settings *rs, const char *line)
+{
+	char params[PARAMS_LEN];
+	snprintf(params, PARAMS_LEN, "%s", line);
+	params[strcspn(params, "#")] = '\0';
+	if (!set_overrides(conf, rs, params))
+		return false;
+	if (0 == strncmp(params, "v2 ", 3))
+		return set_exact_config(conf, params);
+
+	// older files only have the coefficients, rounded to 3 decimal places
+	bool result = true;
+	int cn = attractor_coef_count(conf->type);
+	for (int i = 0; i < 2; ++i)
+		for (int j = 0; j < cn; ++j)
+			result &= (bool)sscanf(params + 7 * (i * cn + j), "%lf", &conf->c[j][i]);
+	attractor_validate(conf);
+	return result;
+}
+
+void attractor_format(struct config *conf, char params[PARAMS_LEN])
+{
+	int c = snprintf(params, PARAMS_LEN, "v2 %s", attractor_map[conf->type]);
+	for (int i = 0; i < 2; ++i)
+		for (int j = 0; j < attractor_coef_count(conf->type); ++j)
+			c += snprintf(params + c, PARAMS_LEN - c, " %a", conf->c[j][i]);
+	double *vecs[] = {conf->x_min, conf->x_max, conf->v_max, conf->seed};
+	for (int k = 0; k < LENGTH(vecs); ++k)
+		for (int i = 0; i < 2; ++i)
+			c += snprintf(params + c, PARAMS_LEN - c, " %a", vecs[k][i]);
+	snprintf(params + c, PARAMS_LEN - c, " %a %a", conf->lyapunov, conf->score);
+}
+
+static double srgb(double L)
+{
+	return L <= 0.0031308 ? L * 12.92
+		: 1.055 * pow(L, 1 / 2.44) - 0.055;
+}
+
+static void hsv_to_rgb(double H, double S, double V, double rgb[3])
+{
+	double C = V * S;
+	double HH = H / 60;
+	double X = C * (1 - fabs(fmod(HH, 2) - 1));
+	switch ((int)floor(HH)) {
+		case 0:
+			rgb[0] = C;
+			rgb[1] = X;
+			rgb[2] = 0;
+			break;
+		case 1:
+			rgb[0] = X;
+			rgb[1] = C;
+			rgb[2] = 0;
+			break;
+		case 2:
+			rgb[0] = 0;
+			rgb[1] = C;
+			rgb[2] = X;
+			break;
+		case 3:
+			rgb[0] = 0;
+			rgb[1] = X;
+			rgb[2] = C;
+			break;
+		case 4:
+			rgb[0] = X;
+			rgb[1] = 0;
+			rgb[2] = C;
+			break;
+		case 5:
+			rgb[0] = C;
+			rgb[1] = 0;
+			rgb[2] = X;
+			break;
+	}
+	double m = V - C;
+	for (int k = 0; k < 3; ++k)
+		rgb[k] = rgb[k] + m;
+}
+
+static void rgb_to_hsv(double r, double g, double b, double *h, double *s, double *v)
+{
+	double x_max = MAX(r, MAX(g, b));
+	double x_min = MIN(r, MIN(g, b));
+	double c = x_max - x_min;
+	*v = x_max;
+	*s = *v == 0 ? 0 : c / *v;
+	*h = c == 0 ?  0 :
+		*v == r ? 60 * ((g - b) / c) :
+		*v == g ? 60 * ((b - r) / c + 2) :
+		60 * ((r - g) / c + 4);
+	*h = *h < 0 ? 360 + *h : *h;
+}
+
+static void hsv_to_hsl(double sv, double v, double *sl, double *l)
+{
+	*l = v * (1 - sv / 2);
+	*sl = *l == 0 || *l == 1 ? 0 : (v - *l) / MIN(*l, 1 - *l);
+}
+
+static void hsl_to_hsv(double sl, double l, double *sv, double *v)
+{
+	*v = l + sl * MIN(l, 1 - l);
+	*sv = *v == 0 ? 0 : 2 * (1 - l / *v);
+}
+
+static void hsl_to_rgb(double h, double s, double l, double rgb[3])
+{
+	double sv, v;
+	hsl_to_hsv(s, l, &sv, &v);
+	hsv_to_rgb(h, sv, v, rgb);
+}
+
+static void rgb_to_hsl(double rgb[3], double *h, double *s, double *l)
+{
+	double sv, v;
+	rgb_to_hsv(rgb[0], rgb[1], rgb[2], h, &sv, &v);
+	hsv_to_hsl(sv, v, s, l);
+}
+
+static void rgb256_to_rgb1(unsigned char rgb256[3], double rgb1[3])
+{
+	for (int k = 0; k < 3; ++k)
+		rgb1[k] = (double)rgb256[k] / 0xff;
+}
+
+static void rgb1_to_rgb256(double rgb1[3], unsigned char rgb256[3])
+{
+	for (int k = 0; k < 3; ++k)
+		rgb256[k] = (unsigned char)(rgb1[k] * 0xff);
+}
+
+static void inv(double rgb[3])
+{
+	for (int k = 0; k < 3; ++k)
+		rgb[k] = 1 - rgb[k];
+}
+
+static void set_brightness(double desired, double rgb1[3], double r[3])
+{
+#if 0
+	double h, s, l;
+	rgb_to_hsl(rgb1, &h, &s, &l);
+	hsl_to_rgb(h, s, desired, r);
+#else
+	double dot = rgb1[0] * rgb1[0] + rgb1[1] * rgb1[1] + rgb1[2] * rgb1[2];
+	double mag = sqrt(dot);
+	if (mag == 0)
+		memcpy(r, rgb1, sizeof(double) * 3);
+	else
+		for (int k = 0; k < 3; ++k) {
+			r[k] = r[k] / mag * sqrt(pow(desired, 2) *3);
+			if (r[k] > 1)
+				r[k] = 1;
+		}
+#endif
+}
+
+static void lerp(double result[3], const double left[3], const double right[3], double t)
+{
+	for (int k = 0; k < 3; ++k)
+		result[k] = (1 -t ) * left[k] + t * right[k];
+}
+
+#define BUF(i, j, k) buf[(i) * rs->width * 3 + (j) * 3 + (k)]
+#define BIG_BUF(i, j, k) big_buf[(i) * D_WIDTH * 3 + (j) * 3 + (k)]
+#define INFO(i, j, k) info[(i) * D_WIDTH * 4 + (j) * 4 + (k)]
+
+// one frame being drawn, the image is drawn downscale times larger into
+// big_buf while info accumulates hits and velocities per pixel
+struct render_target {
+	int D_WIDTH, D_HEIGHT;
+	unsigned char *big_buf;
+	double *info;
+	double range[2];
+	int o;
+	double x_scale, y_scale;
+	unsigned count;	// pixels hit
+};
+
+static void render_begin(const struct render_settings *rs, struct config *conf, struct render_target *t, unsigned char *buf)
+{
+	unsigned char bg = rs->light ? 0xff : 0;
+	int D_WIDTH = t->D_WIDTH = rs->width * rs->downscale;
+	int D_HEIGHT = t->D_HEIGHT = rs->height * rs->downscale;
+	t->big_buf = rs->downscale > 1 ?
+		malloc(sizeof(char) * D_HEIGHT * D_WIDTH * 3) :
+		buf;
+	memset(t->big_buf, bg, sizeof(char) * D_HEIGHT * D_WIDTH * 3);
+	t->info = calloc(1, sizeof(double) * D_HEIGHT * D_WIDTH * 4);
+
+	t->range[0] = conf->x_max[0] - conf->x_min[0];
+	t->range[1] = conf->x_max[1] - conf->x_min[1];
+	int o = t->o = t->range[0] < t->range[1];
+	t->x_scale = (D_WIDTH - 1) / (conf->x_max[o] - conf->x_min[o]) * (1 - rs->border);
+	t->y_scale = (D_HEIGHT - 1) / (conf->x_max[!o] - conf->x_min[!o]) * (1 - rs->border);
+	if (!rs->stretch) {
+		if (t->x_scale > t->y_scale)
+			t->x_scale = t->y_scale;
+		else
+			t->y_scale = t->x_scale;
+	}
+	t->count = 0;
+}
+
+// add the point x, which moved by v, to its pixel
+static void render_plot(const struct render_settings *rs, struct config *conf, struct render_target *t, vec x, vec v)
+{
+	int D_WIDTH = t->D_WIDTH, D_HEIGHT = t->D_HEIGHT;
+	double *info = t->info;
+	int o = t->o;
+	int i = (int)((D_HEIGHT - t->range[!o] * t->y_scale) / 2 + (x[!o] - conf->x_min[!o]) * t->y_scale);
+	int j = (int)((D_WIDTH  - t->range[ o] * t->x_scale) / 2 + (x[ o] - conf->x_min[ o]) * t->x_scale);
+	if (i < 0 || i >= D_HEIGHT) return;
+	if (j < 0 || j >= D_WIDTH) return;
+
+	t->count += INFO(i, j, 0) == 0;
+	INFO(i, j, 0) += 1;
+	switch (conf->colour) {
+		case HSV:
+		case HSL:
+			vec w = {v[1] / conf->v_max[1], v[0] / conf->v_max[0]};
+			double m = mag(w);
+			INFO(i, j, 1) += w[1] / m;
+			INFO(i, j, 2) += w[0] / m;
+			break;
+		case MIX:
+			for (int k = 0; k < 3; ++k)
+				INFO(i, j, k + 1) += fabs(dot(u[k], v)) / sqrt(dot(conf->v_max, conf->v_max));
+			break;
+		case RGB:
+			INFO(i, j, 1) += MAX(0, v[0] / conf->v_max[0]);
+			INFO(i, j, 2 + rs->light) += MAX(0, -v[0] / conf->v_max[0]);
+			INFO(i, j, 3 - rs->light) += fabs(v[1]) / conf->v_max[1];
+			break;
+		default:
+			break;
+	}
+}
+
+// turn the accumulated pixels into colours and scale them down into buf
+static void render_finish(const struct attractor_context *context, const struct render_settings *rs,
+                          struct config *conf, struct render_target *target, unsigned char *buf)
+{
+	long long unsigned iterations = (long long unsigned)rs->width * rs->height * rs->quality;
+	int D_WIDTH = target->D_WIDTH, D_HEIGHT = target->D_HEIGHT;
+	unsigned char *big_buf = target->big_buf;
+	double *info = target->info;
+	unsigned count = target->count;
+	double DENSITY = (double)iterations / count;
+
+	for (int i = 0; i < D_HEIGHT; ++i)
+		for (int j = 0; j < D_WIDTH; ++j) {
+			if (INFO(i, j, 0) == 0)
+				continue;
+			double v = rs->intensity / DENSITY * INFO(i, j, 0) / 0xff;
+			v = MIN(1, conf->colour == HSV ? v * 2 : v);
+			v = sqrt(v);
+			switch (conf->colour) {
+				case HSV:
+				case HSL:
+				{
+					double h = 180 + atan2(INFO(i, j, 1), INFO(i, j, 2)) * 180 / M_PI;
+					double s = mag((double *)&INFO(i, j, 1)) / INFO(i, j, 0);
+					double rgb[3];
+					(conf->colour == HSV ? hsv_to_rgb : hsl_to_rgb)(h, s, v, rgb);
+					if (rs->light) inv(rgb);
+					rgb1_to_rgb256(rgb, &BIG_BUF(i, j, 0));
+					break;
+				}
+				case BW:
+				{
+					for (int k = 0; k < 3; ++k)
+						BIG_BUF(i, j, k) = (char)((rs->light ? 1 - v : v) * 0xff);
+					break;
+				}
+				case MIX:
+				case RGB:
+				{
+					double rgb[3];
+					for (int k = 0; k < 3; ++k)
+						rgb[k] = MIN(1, INFO(i, j, k + 1) * rs->intensity / DENSITY/ 0xff);
+					set_brightness(v, rgb, rgb);
+					if (rs->light) inv(rgb);
+					rgb1_to_rgb256(rgb, &BIG_BUF(i, j, 0));
+					break;
+				}
+				// gradient map
+				default:
+				{
+					double g = (rs->light ? 1 - v : v) * (GN - 1);
+					double t = fmod(g, 1);
+					int l = (int)floor(g), r = (int)ceil(g);
+					double rgb[3];
+					lerp(rgb, context->gradients[conf->colour][l], context->gradients[conf->colour][r], t);
+					for (int k = 0; k < 3; ++k)
+						BIG_BUF(i, j, k) = (char)rgb[k];
+					break;
+				}
+			}
+		}
+
+	if (rs->downscale >  1) {
+		stbir_resize_uint8_srgb((unsigned char *)big_buf, D_WIDTH, D_HEIGHT, D_WIDTH * sizeof(char) * 3,
+		                        (unsigned char *)buf, rs->width, rs->height, rs->width * sizeof(char) * 3,
+		                        STBIR_RGB);
+		free(big_buf);
+	}
+	free(info);
+
+#if 0
+	// write debug gradient map
+	for (int j = 0; j < MIN(600, D_HEIGHT); ++j) {
+		double v = (double)j / 600 * (GN - 1);
+		double t = fmod(v, 1);
+		int l = (int)floor(v);
+		int r = (int)ceil(v);
+		for (int i = 0; i < 20; ++i)
+			for (int k = 0; k < 3; ++k)
+				BUF(i, j, k) = (char)((1 - t) * context->gradients[conf->colour][l][k] + t * context->gradients[conf->colour][r][k]);
+
+	}
+#endif
+}
+
+// carry an orbit from a nearby attractor onto conf's
+static void carry_orbit(struct config *conf, vec x, const vec from)
+{
+	memcpy(x, from, sizeof(vec));
+	for (unsigned n = 0; n < SETTLE; ++n)
+		iteration(conf->type, conf->c, x);
+	// the orbit fell off, the attractor must have changed too much
+	if (!(fabs(x[0]) < 1e10 && fabs(x[1]) < 1e10)) {
+		memset(x, 0, sizeof(vec));
+		start_orbit(conf, x);
+	}
+}
+
+void attractor_render_from(const struct attractor_context *context, const struct render_settings *rs,
+                           struct config *conf, unsigned char *buf, vec orbit, bool carry)
+{
+	long long unsigned iterations = (long long unsigned)rs->width * rs->height * rs->quality;
+	struct render_target t;
+	render_begin(rs, conf, &t, buf);
+
+	vec x = {0};
+	if (carry && !conf->seeded)
+		carry_orbit(conf, x, orbit);
+	else
+		start_orbit(conf, x);
+
+	for (long long unsigned n = CUTOFF; n < iterations; ++n) {
+		vec x_last;
+		vec v;
+		for (int i = 0; i < 2; ++i)
+			x_last[i] = x[i];
+		iteration(conf->type, conf->c, x);
+		for (int i = 0; i < 2; ++i)
+			v[i] = x[i] - x_last[i];
+		render_plot(rs, conf, &t, x, v);
+	}
+	memcpy(orbit, x, sizeof(vec));
+	render_finish(context, rs, conf, &t, buf);
+}
+
+void attractor_render_lanes(const struct attractor_context *context, const struct render_settings *rs,
+                            struct config *confs, int count, unsigned char *rgb[])
+{
+	assert(count > 0 && count <= ATTRACTOR_LANES);
+	long long unsigned iterations = (long long unsigned)rs->width * rs->height * rs->quality;
+	enum attractor_type type = confs[0].type;
+	struct render_target t[LANES];
+	coef_lanes c = {0};
+	vec_lanes x;
+	vec start;
+	for (int l = 0; l < count; ++l) {
+		assert(confs[l].type == type);
+		render_begin(rs, &confs[l], &t[l], rgb[l]);
+		for (int j = 0; j < 8; ++j)
+			for (int i = 0; i < 2; ++i)
+				c[j][i][l] = confs[l].c[j][i];
+
+		vec y = {0};
+		if (l > 0 && !confs[l].seeded)
+			carry_orbit(&confs[l], y, start);
+		else
+			start_orbit(&confs[l], y);
+		memcpy(start, y, sizeof(vec));
+		for (int i = 0; i < 2; ++i)
+			x[i][l] = y[i];
+	}
+
+	for (long long unsigned n = CUTOFF; n < iterations; ++n) {
+		vec_lanes x_last;
+		memcpy(x_last, x, sizeof(vec_lanes));
+		iteration_lanes(type, c, x, count);
+		for (int l = 0; l < count; ++l) {
+			vec y = {x[0][l], x[1][l]};
+			vec v = {x[0][l] - x_last[0][l], x[1][l] - x_last[1][l]};
+			render_plot(rs, &confs[l], &t[l], y, v);
+		}
+	}
+	for (int l = 0; l < count; ++l)
+		render_finish(context, rs, &confs[l], &t[l], rgb[l]);
+}
+
+void attractor_render(const struct attractor_context *context, const struct render_settings *rs, struct config *conf, unsigned char *buf)
+{
+	vec orbit;
+	attractor_render_from(context, rs, conf, buf, orbit, false);
+}
+
+// the gradients are rescaled so their brightness rises evenly
+struct attractor_context *attractor_create(void)
+{
+	struct attractor_context *context = malloc(sizeof(struct attractor_context));
+	if (context == NULL)
+		return NULL;
+	for (int g = 0; g < NUM_GRADIENTS; ++g)
+		for (int i = 0; i < GN; ++i) {
+			double tmp[3];
+			for (int k = 0; k < 3; ++k)
+				tmp[k] = gradients[g][i][k] / 0xff;
+			set_brightness((double)i / (GN - 1), tmp, tmp);
+			for (int k = 0; k < 3; ++k)
+				context->gradients[g][i][k] = tmp[k] * 0xff;
+		}
+	return context;
+}
+
+void attractor_destroy(struct attractor_context *context)
+{
+	free(context);
+}
+
+// xorshift, state must not be 0
+static unsigned next_random(unsigned *state)
+{
+	unsigned x = *state ? *state : 1;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+void attractor_search(struct config *conf, unsigned *seed)
+{
+	do {
+		for (int i = 0; i < 2; ++i)
+			for (int j = 0; j < attractor_coef_count(conf->type); ++j)
+				conf->c[j][i] = -2 + 4 * (next_random(seed) / 4294967296.0);
+	} while (!attractor_validate(conf));
+}
+
+// stb's deflate uses fixed huffman codes, which are at most 9 bits a byte
+size_t attractor_png_bound(int width, int height)
+{
+	size_t raw = (size_t)height * (width * 3 + 1);
+	return raw + raw / 8 + 1024;
+}
+
+size_t attractor_encode_png(const unsigned char *rgb, int width, int height, unsigned char *out, size_t size)
+{
+	int len;
+	unsigned char *png = stbi_write_png_to_mem(rgb, width * 3, width, height, 3, &len);
+	if (png == NULL)
+		return 0;
+	size_t result = (size_t)len <= size ? (size_t)len : 0;
+	if (result)
+		memcpy(out, png, result);
+	STBIW_FREE(png);
+	return result;
+}
+
+size_t attractor_jpg_bound(int width, int height)
+{
+	return (size_t)width * height * 3 + 1024;
+}
+
+struct jpg_buffer {
+	unsigned char *out;
+	size_t size, len;	// len goes past size once it doesn't fit
+};
+
+static void jpg_write(void *context, void *data, int size)
+{
+	struct jpg_buffer *b = (struct jpg_buffer *)context;
+	if (b->len + size <= b->size)
+		memcpy(b->out + b->len, data, size);
+	b->len += size;
+}
+
+size_t attractor_encode_jpg(const unsigned char *rgb, int width, int height, int quality,
+                            unsigned char *out, size_t size)
+{
+	struct jpg_buffer b = {out, size, 0};
+	if (!stbi_write_jpg_to_func(jpg_write, &b, width, height, 3, rgb, quality))
+		return 0;
+	return b.len <= size ? b.len : 0;
+}
+
+#endif
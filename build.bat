@@ -1,3 +1,7 @@
 @echo off
 cl /nologo /Zi /W4 /wd4996 /wd4505 /wd4127 /Od main.c
+
+rem the render library, for embedding without the command line
+cl /nologo /W4 /wd4996 /wd4505 /wd4127 /O2 /c attractor.c
+lib /nologo attractor.obj
 start /b update_readme.bat > readme.md
@@ -1,2 +1,7 @@
 #!/usr/bin/env sh
-gcc -Wall -Wno-unused-function -Wno-array-bounds -lm -O2 -o main main.c
+gcc -Wall -Wno-unused-function -Wno-array-bounds -O2 -o main main.c -lm -lpthread
+
+# the render library, for embedding without the command line
+gcc -Wall -Wno-unused-function -Wno-array-bounds -O2 -fPIC -c -o attractor.o attractor.c
+ar rcs libattractor.a attractor.o
+gcc -shared -o libattractor.so attractor.o -lm
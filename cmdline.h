@@ -1,28 +1,55 @@
 enum option_mode {
 	IMAGE = 1,
 	VIDEO = 2,
+	SCAN = 3,
+	GALLERY = 4,
+};
+
+char *mode_map[] = {
+	[IMAGE] = "image",
+	[VIDEO] = "video",
+	[SCAN] = "scan",
+	[GALLERY] = "gallery",
 };
 
 enum option_name {
 	OP_BORDER,
+	OP_BOUNDS_STRIDE,
+	OP_CANDIDATES,
 	OP_COEFFICIENT,
 	OP_COLOUR,
 	OP_COLOUR_PREVIEW,
+	OP_COUNT,
+	OP_DB,
+	OP_DELTA_FRAMES,
 	OP_DOWNSCALE,
 	OP_DURATION,
 	OP_END,
 	OP_FPS,
+	OP_FROM_DB,
 	OP_HEIGHT,
 	OP_INTENSITY,
+	OP_INVALID_FRAMES,
+	OP_JPEG_QUALITY,
 	OP_LIGHT,
 	OP_LOSSLESS,
+	OP_MIN_SCORE,
+	OP_MODEL,
+	OP_OUT,
 	OP_OUT_DIR,
 	OP_PARAMS,
 	OP_PREVIEW,
 	OP_QUALITY,
+	OP_RANGE,
+	OP_RESOLUTION,
+	OP_SCAN_COEFFICIENTS,
+	OP_SEARCH,
+	OP_SIMILARITY,
+	OP_SINK,
 	OP_START,
 	OP_STRETCH,
 	OP_THREADS,
+	OP_TIME_LIMIT,
 	OP_TYPE,
 	OP_WIDTH,
 };
@@ -33,47 +60,59 @@ enum option_type {
 	TY_DOUBLE,
 	TY_ENUM,
 	TY_INT,
+	TY_INVALID,
+	TY_SEARCH,
+	TY_SINK,
 	TY_STRING,
 };
 
-enum colour_type {
-	INF,
-	BLA,
-	VID,
-	ICE,
-	BW,
-	HSV,
-	HSL,
-	RGB,
-	MIX,
-	COLOUR_COUNT,
+enum search_type {
+	SEARCH_UNIFORM,
+	SEARCH_HISTOGRAM,
+	SEARCH_MUTATE,
+	SEARCH_COUNT,
+};
+
+char *search_map[] = {
+	[SEARCH_UNIFORM] = "UNIFORM",
+	[SEARCH_HISTOGRAM] = "HISTOGRAM",
+	[SEARCH_MUTATE] = "MUTATE",
+};
+
+// what to do with video frames that aren't chaotic
+enum invalid_type {
+	INVALID_TRIM,
+	INVALID_FAIL,
+	INVALID_SKIP,
+	INVALID_COUNT,
 };
 
-char *colour_map[] = {
-	[INF] = "INF",
-	[BLA] = "BLA",
-	[VID] = "VID",
-	[ICE] = "ICE",
-	[BW] = "BW",
-	[HSV] = "HSV",
-	[HSL] = "HSL",
-	[RGB] = "RGB",
-	[MIX] = "MIX",
+char *invalid_map[] = {
+	[INVALID_TRIM] = "TRIM",
+	[INVALID_FAIL] = "FAIL",
+	[INVALID_SKIP] = "SKIP",
 };
 
-enum attractor_type {
-	AT_POLY,
-	AT_TRIG,
-	AT_SAW,
-	AT_TRI,
-	AT_COUNT,
+// where the frames of a video go
+enum sink_type {
+	SINK_FFMPEG,
+	SINK_Y4M,
+	SINK_YUV,
+	SINK_RGB,
+	SINK_IMAGES,
+	SINK_AVI,
+	SINK_APNG,
+	SINK_COUNT,
 };
 
-char *attractor_map[] = {
-	[AT_POLY] = "POLY",
-	[AT_TRIG] = "TRIG",
-	[AT_SAW] = "SAW",
-	[AT_TRI] = "TRI",
+char *sink_map[] = {
+	[SINK_FFMPEG] = "FFMPEG",
+	[SINK_Y4M] = "Y4M",
+	[SINK_YUV] = "YUV",
+	[SINK_RGB] = "RGB",
+	[SINK_IMAGES] = "IMAGES",
+	[SINK_AVI] = "AVI",
+	[SINK_APNG] = "APNG",
 };
 
 struct option {
@@ -98,6 +137,21 @@ struct option options[] = {
 		.doc = "(a negative value will crop the image)",
 		.set = true,
 	},
+	[OP_BOUNDS_STRIDE] = {
+		.str = "bounds-stride",
+		.mode = VIDEO,
+		.type = TY_INT,
+		.val.d = 1,
+		.doc = "validate every nth frame to find the bounds of the video, more than 1 adds a margin and the frames in between take the verdict of the one before, ignored with -invalid-frames FAIL",
+		.set = true,
+	},
+	[OP_CANDIDATES] = {
+		.str = "candidates",
+		.type = TY_INT,
+		.val.d = 1,
+		.doc = "search this many attractors and keep the one with the best score",
+		.set = true,
+	},
 	[OP_COEFFICIENT] = {
 		.str = "coefficient",
 		.mode = VIDEO,
@@ -119,6 +173,27 @@ struct option options[] = {
 		.conflicts = OP_PREVIEW,
 		.mode = IMAGE,
 	},
+	[OP_COUNT] = {
+		.str = "count",
+		.mode = GALLERY,
+		.type = TY_INT,
+		.val.d = 100,
+		.doc = "number of distinct attractors to write",
+		.set = true,
+	},
+	[OP_DB] = {
+		.str = "db",
+		.type = TY_STRING,
+		.doc = "database to store found attractors in, one file <db>_<type>.db per type",
+	},
+	[OP_DELTA_FRAMES] = {
+		.str = "delta-frames",
+		.mode = VIDEO,
+		.type = TY_INT,
+		.val.d = 0,
+		.doc = "with -sink APNG, only encode the part of a frame that changed since the one before it",
+		.set = true,
+	},
 	[OP_DOWNSCALE] = {
 		.str = "downscale",
 		.type = TY_INT,
@@ -149,6 +224,13 @@ struct option options[] = {
 		.conflicts = OP_PREVIEW,
 		.set = true,
 	},
+	[OP_FROM_DB] = {
+		.str = "from-db",
+		.type = TY_INT,
+		.doc = "take attractors from -db instead of searching, 1: next unused, 2: random",
+		.val.d = 0,
+		.conflicts = OP_PARAMS,
+	},
 	[OP_HEIGHT] = {
 		.str = "height",
 		.type = TY_INT,
@@ -162,6 +244,22 @@ struct option options[] = {
 		.doc = "how bright the iterations make each pixel",
 		.set = true,
 	},
+	[OP_INVALID_FRAMES] = {
+		.str = "invalid-frames",
+		.mode = VIDEO,
+		.type = TY_INVALID,
+		.val.d = INVALID_TRIM,
+		.doc = "frames that aren't chaotic, TRIM narrows -start and -end to the valid frames and leaves out any invalid ones between them, FAIL validates every frame and lists the invalid ones, SKIP leaves them out",
+		.set = true,
+	},
+	[OP_JPEG_QUALITY] = {
+		.str = "jpeg-quality",
+		.mode = VIDEO,
+		.type = TY_INT,
+		.val.d = 90,
+		.doc = "quality of the frames of -sink AVI, between 1 and 100",
+		.set = true,
+	},
 	[OP_LIGHT] = {
 		.str = "light",
 		.type = TY_INT,
@@ -177,6 +275,24 @@ struct option options[] = {
 		.mode = VIDEO,
 		.set = true,
 	},
+	[OP_MIN_SCORE] = {
+		.str = "min-score",
+		.type = TY_DOUBLE,
+		.val.f = 0,
+		.doc = "reject attractors scoring below this, between 0 (thin lines, small blobs) and 1",
+		.set = true,
+	},
+	[OP_MODEL] = {
+		.str = "model",
+		.type = TY_STRING,
+		.doc = "file to load and save what -search has learnt from previous attractors",
+	},
+	[OP_OUT] = {
+		.str = "out",
+		.mode = VIDEO,
+		.type = TY_STRING,
+		.doc = "file to write the video to, - for stdout with Y4M, YUV, RGB or APNG, IMAGES numbers its files after it, default: out.<ext> in -out-dir",
+	},
 	[OP_OUT_DIR] = {
 		.str = "out-dir",
 		.type = TY_STRING,
@@ -186,7 +302,7 @@ struct option options[] = {
 	[OP_PARAMS] = {
 		.str = "params",
 		.type = TY_STRING,
-		.doc = "file containing parameters",
+		.doc = "file containing parameters, lines can end with -width -height -quality -colour -type",
 		.conflicts = OP_PREVIEW,
 	},
 	[OP_PREVIEW] = {
@@ -201,6 +317,51 @@ struct option options[] = {
 		.doc = "how many iterations to do per pixel",
 		.set = true,
 	},
+	[OP_RANGE] = {
+		.str = "range",
+		.mode = SCAN,
+		.type = TY_DOUBLE,
+		.val.f = 0.5,
+		.doc = "sweep each coefficient by +-<range> around its value",
+		.set = true,
+	},
+	[OP_RESOLUTION] = {
+		.str = "resolution",
+		.mode = SCAN,
+		.type = TY_INT,
+		.val.d = 128,
+		.doc = "number of grid cells along each coefficient",
+		.set = true,
+	},
+	[OP_SCAN_COEFFICIENTS] = {
+		.str = "coefficients",
+		.mode = SCAN,
+		.type = TY_STRING,
+		.doc = "two coefficients to sweep, must have regex \"[xy]\\d,[xy]\\d\"",
+	},
+	[OP_SEARCH] = {
+		.str = "search",
+		.type = TY_SEARCH,
+		.val.d = SEARCH_UNIFORM,
+		.doc = "how to draw coefficients when searching",
+		.set = true,
+	},
+	[OP_SIMILARITY] = {
+		.str = "similarity",
+		.mode = GALLERY,
+		.type = TY_DOUBLE,
+		.val.f = 0.15,
+		.doc = "drop attractors whose fingerprints differ by less than this, between 0 and 2",
+		.set = true,
+	},
+	[OP_SINK] = {
+		.str = "sink",
+		.mode = VIDEO,
+		.type = TY_SINK,
+		.val.d = SINK_FFMPEG,
+		.doc = "FFMPEG encodes an mp4, Y4M and YUV write the frames as yuv, RGB as rgb24, IMAGES as pngs, AVI as mjpeg and APNG as a looping animated png",
+		.set = true,
+	},
 	[OP_START] = {
 		.str = "start",
 		.mode = VIDEO,
@@ -219,6 +380,14 @@ struct option options[] = {
 		.type = TY_INT,
 		.doc = "number of threads to use",
 	},
+	[OP_TIME_LIMIT] = {
+		.str = "time-limit",
+		.mode = GALLERY,
+		.type = TY_INT,
+		.val.d = 0,
+		.doc = "stop after this many seconds, 0 for no limit",
+		.set = true,
+	},
 	[OP_TYPE] = {
 		.str = "type",
 		.type = TY_ATTRACTOR,
@@ -233,24 +402,42 @@ struct option options[] = {
 };
 
 #define BORDER         options[OP_BORDER].val.f
+#define BOUNDS_STRIDE  options[OP_BOUNDS_STRIDE].val.d
+#define CANDIDATES     options[OP_CANDIDATES].val.d
 int CI, CJ, CN = 6;
 #define COLOUR         options[OP_COLOUR].val.d
 #define COLOUR_PREVIEW options[OP_COLOUR_PREVIEW].val.d
+#define COUNT          options[OP_COUNT].val.d
+#define DB             options[OP_DB].val.s
+#define DELTA_FRAMES   options[OP_DELTA_FRAMES].val.d
 #define DOWNSCALE      options[OP_DOWNSCALE].val.d
 #define DURATION       options[OP_DURATION].val.d
 #define END            options[OP_END].val.f
 #define FPS            options[OP_FPS].val.d
+#define FROM_DB        options[OP_FROM_DB].val.d
 #define HEIGHT         options[OP_HEIGHT].val.d
 #define INTENSITY      options[OP_INTENSITY].val.f
+#define INVALID_FRAMES options[OP_INVALID_FRAMES].val.d
+#define JPEG_QUALITY   options[OP_JPEG_QUALITY].val.d
 #define LIGHT          options[OP_LIGHT].val.d
 #define LOSSLESS       options[OP_LOSSLESS].val.d
+#define MIN_SCORE      options[OP_MIN_SCORE].val.f
+#define MODEL          options[OP_MODEL].val.s
+#define OUT            options[OP_OUT].val.s
 #define OUT_DIR        options[OP_OUT_DIR].val.s
 #define PARAMS         options[OP_PARAMS].val.s
 #define PREVIEW        options[OP_PREVIEW].val.d
 #define QUALITY        options[OP_QUALITY].val.d
+#define RANGE          options[OP_RANGE].val.f
+#define RESOLUTION     options[OP_RESOLUTION].val.d
+#define SCAN_COEFFICIENTS options[OP_SCAN_COEFFICIENTS].val.s
+#define SEARCH         options[OP_SEARCH].val.d
+#define SIMILARITY     options[OP_SIMILARITY].val.f
+#define SINK           options[OP_SINK].val.d
 #define START          options[OP_START].val.f
 #define STRETCH        options[OP_STRETCH].val.d
 #define THREADS        options[OP_THREADS].val.d
+#define TIME_LIMIT     options[OP_TIME_LIMIT].val.d
 #define TYPE           options[OP_TYPE].val.d
 #define WIDTH          options[OP_WIDTH].val.d
 
@@ -273,6 +460,12 @@ static char *type_str(enum option_type type)
 			return "<colour enum>";
 		case TY_ATTRACTOR:
 			return "<attractor type enum>";
+		case TY_INVALID:
+			return "<invalid frames enum>";
+		case TY_SEARCH:
+			return "<search enum>";
+		case TY_SINK:
+			return "<sink enum>";
 		case TY_STRING:
 		case TY_COEFFICIENT:
 			return "<string>";
@@ -333,19 +526,30 @@ static void val_str(struct option *o, char buf[256])
 		case TY_ATTRACTOR:
 			strncpy(buf, attractor_map[o->val.d], 256);
 			break;
+		case TY_INVALID:
+			snprintf(buf, 256, "%s", invalid_map[o->val.d]);
+			break;
+		case TY_SEARCH:
+			snprintf(buf, 256, "%s", search_map[o->val.d]);
+			break;
+		case TY_SINK:
+			snprintf(buf, 256, "%s", sink_map[o->val.d]);
+			break;
 		default:
 			exit(1);
 	}
 }
 
-static void align(char (*buf)[256], char (*left)[256], char (*right)[256], int height)
+// print left and right as two columns, straight to stdout as a line can be
+// longer than either of them
+static void align(char (*left)[256], char (*right)[256], int height)
 {
 	int width = 0;
 	for (int i = 0; i < height; ++i)
 		width = MAX(width, (int)strlen(left[i]));
 
 	for (int i = 0; i < height; ++i)
-		snprintf(buf[i], 256, "%s%*s%s", left[i], width - (int)strlen(left[i]) + 2, "", right[i]);
+		printf("  %s%*s%s\n", left[i], width - (int)strlen(left[i]) + 2, "", right[i]);
 }
 
 static void join(char buf[256], char (*strs)[256], char *sep, int len)
@@ -367,6 +571,12 @@ static void help_option(enum option_mode mode)
 		case VIDEO:
 			printf("\nvideo options\n");
 			break;
+		case SCAN:
+			printf("\nscan options\n");
+			break;
+		case GALLERY:
+			printf("\ngallery options\n");
+			break;
 		default:
 			printf("\ncommon options\n");
 			break;
@@ -400,10 +610,7 @@ static void help_option(enum option_mode mode)
 	}
 
 	// align them and print
-	char (*buf)[256] = left;
-	align(buf, left, right, len);
-	for (int i = 0; i < len; ++i)
-		printf("  %s\n", buf[i]);
+	align(left, right, len);
 }
 
 static void help(void)
@@ -411,19 +618,24 @@ static void help(void)
 	printf("usage\n");
 	help_mode("attractor image", IMAGE);
 	help_mode("attractor video", VIDEO);
+	help_mode("attractor scan", SCAN);
+	help_mode("attractor gallery", GALLERY);
 
 	help_option(IMAGE);
 	help_option(VIDEO);
+	help_option(SCAN);
+	help_option(GALLERY);
 	help_option(0); // common options
 
 	printf("\nenums\n");
-	char left[2][256] = {"<colour enum>", "<attractor type enum>"};
-	char right[2][256];
+	char left[5][256] = {"<colour enum>", "<attractor type enum>", "<search enum>", "<invalid frames enum>", "<sink enum>"};
+	char right[5][256];
 	enum_str(right[0], colour_map, COLOUR_COUNT);
 	enum_str(right[1], attractor_map, AT_COUNT);
-	align(left, left, right, 2);
-	for (int i = 0; i < 2; ++i)
-		printf("  %s\n", left[i]);
+	enum_str(right[2], search_map, SEARCH_COUNT);
+	enum_str(right[3], invalid_map, INVALID_COUNT);
+	enum_str(right[4], sink_map, SINK_COUNT);
+	align(left, right, 5);
 
 }
 
@@ -470,7 +682,7 @@ static void parse_option(int mode, char *flag, char *val)
 
 		// check mode is valid
 		if (options[o].mode && options[o].mode != mode) {
-			fprintf(stderr, "%s not allowed in %s mode\n", flag, mode == VIDEO ? "video" : "image");
+			fprintf(stderr, "%s not allowed in %s mode\n", flag, mode_map[mode]);
 			exit(1);
 		}
 
@@ -495,20 +707,31 @@ static void parse_option(int mode, char *flag, char *val)
 			option_type_error(flag, options[o].type, val); \
 	} break;
 			CASE(BORDER);
+			CASE(BOUNDS_STRIDE);
+			CASE(CANDIDATES);
 			CASE(COLOUR_PREVIEW);
+			CASE(COUNT);
+			CASE(DELTA_FRAMES);
 			CASE(DOWNSCALE);
 			CASE(DURATION);
 			CASE(END);
 			CASE(FPS);
+			CASE(FROM_DB);
 			CASE(HEIGHT);
 			CASE(INTENSITY);
+			CASE(JPEG_QUALITY);
 			CASE(LIGHT);
 			CASE(LOSSLESS);
+			CASE(MIN_SCORE);
 			CASE(PREVIEW);
 			CASE(QUALITY);
+			CASE(RANGE);
+			CASE(RESOLUTION);
+			CASE(SIMILARITY);
 			CASE(START);
 			CASE(STRETCH);
 			CASE(THREADS);
+			CASE(TIME_LIMIT);
 			CASE(WIDTH);
 #undef CASE
 			case OP_COLOUR:
@@ -534,6 +757,42 @@ static void parse_option(int mode, char *flag, char *val)
 				CN = TYPE == AT_POLY ? 6 : 8;
 				break;
 			}
+			case OP_SEARCH:
+			{
+				int i;
+				for (i = 0; i < LENGTH(search_map); ++i)
+					if (0 == strcmp(search_map[i], val))
+						break;
+				if (i == LENGTH(search_map))
+					option_type_error(flag, options[o].type, val);
+				SEARCH = i;
+				break;
+			}
+			case OP_INVALID_FRAMES:
+			{
+				int i;
+				for (i = 0; i < LENGTH(invalid_map); ++i)
+					if (0 == strcmp(invalid_map[i], val))
+						break;
+				if (i == LENGTH(invalid_map))
+					option_type_error(flag, options[o].type, val);
+				INVALID_FRAMES = i;
+				break;
+			}
+			case OP_SINK:
+			{
+				int i;
+				for (i = 0; i < LENGTH(sink_map); ++i)
+					if (0 == strcmp(sink_map[i], val))
+						break;
+				if (i == LENGTH(sink_map))
+					option_type_error(flag, options[o].type, val);
+				SINK = i;
+				break;
+			}
+			case OP_MODEL:
+				MODEL = val;
+				break;
 			case OP_COEFFICIENT:
 			{
 				char c;
@@ -547,10 +806,24 @@ static void parse_option(int mode, char *flag, char *val)
 			case OP_PARAMS:
 				PARAMS = val;
 				break;
+			case OP_SCAN_COEFFICIENTS:
+				SCAN_COEFFICIENTS = val;
+				break;
+			case OP_DB:
+				DB = val;
+				break;
+			case OP_OUT:
+				OUT = val;
+				break;
 			case OP_OUT_DIR:
 				OUT_DIR = val;
 				break;
 		}
+		// a score no attractor can reach would search forever
+		if (o == OP_MIN_SCORE && !(MIN_SCORE >= 0 && MIN_SCORE <= 1))
+			option_error(flag, "a score between 0 and 1", val);
+		if (o == OP_RESOLUTION && RESOLUTION < 1)
+			option_error(flag, "at least 1 cell", val);
 
 		// finally mark the option as set
 		options[o].set = true;
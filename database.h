@@ -0,0 +1,93 @@
+// on-disk database of validated attractors, one file per attractor type
+
+#define DB_MAGIC   0x42445441 // "ATDB"
+#define DB_VERSION 2
+
+struct db_record {
+	double c[8][2];
+	double x_min[2], x_max[2], v_max[2];
+	double seed[2];
+	double lyapunov;
+	double score;
+};
+
+struct db_header {
+	unsigned magic;
+	unsigned version;
+	int type;
+	int cn;
+	long long count;
+	long long next_unused;
+};
+
+struct database {
+	struct mapped_file file;
+	struct db_header *header;
+	struct db_record *records;
+	long long capacity;
+	char name[256];
+};
+
+static bool db_map(struct database *db, size_t size)
+{
+	if (!map_file(&db->file, db->name, size))
+		return false;
+	db->header = (struct db_header *)db->file.data;
+	db->records = (struct db_record *)(db->header + 1);
+	db->capacity = (long long)((db->file.size - sizeof(struct db_header)) / sizeof(struct db_record));
+	return true;
+}
+
+static bool db_open(struct database *db, const char *stem, int type, int cn)
+{
+	snprintf(db->name, 256, "%s_%s.db", stem, attractor_map[type]);
+	if (!db_map(db, sizeof(struct db_header) + sizeof(struct db_record) * 64))
+		return false;
+
+	struct db_header *h = db->header;
+	if (h->magic == 0) {
+		h->magic = DB_MAGIC;
+		h->version = DB_VERSION;
+		h->type = type;
+		h->cn = cn;
+	} else if (h->magic != DB_MAGIC || h->version != DB_VERSION || h->type != type || h->cn != cn) {
+		unmap_file(&db->file);
+		return false;
+	}
+	return true;
+}
+
+static void db_close(struct database *db)
+{
+	unmap_file(&db->file);
+}
+
+static bool db_append(struct database *db, struct db_record *r)
+{
+	if (db->header->count == db->capacity) {
+		size_t size = db->file.size;
+		unmap_file(&db->file);
+		if (!db_map(db, sizeof(struct db_header) + (size - sizeof(struct db_header)) * 2))
+			return false;
+	}
+	// only publish the record once it has been written
+	db->records[db->header->count] = *r;
+	++db->header->count;
+	return true;
+}
+
+// pick the next unused record, or a random one once they have all been used
+static bool db_pick(struct database *db, struct db_record *r, bool random)
+{
+	struct db_header *h = db->header;
+	if (h->count == 0)
+		return false;
+
+	long long i;
+	if (!random && h->next_unused < h->count)
+		i = h->next_unused++;
+	else
+		i = ((long long)rand() * RAND_MAX + rand()) % h->count;
+	*r = db->records[i];
+	return true;
+}
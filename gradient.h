@@ -7,7 +7,7 @@ enum gradient {
 
 #define GN 8
 
-double gradients[NUM_GRADIENTS][GN][3] = {
+static const double gradients[NUM_GRADIENTS][GN][3] = {
 	// https://www.kennethmoreland.com/color-advice/
 	[VIRIDIS] = {{68, 1, 84}, {70, 50, 127}, {54, 92, 141}, {39, 127, 142}, {31, 161, 135}, {74, 194, 109}, {159, 218, 58}, {253, 231, 37}},
 	[KINDLMANN] = {{0, 0, 0}, {36, 6, 117}, {7, 62, 150}, {5, 115, 97}, {8, 159, 21}, {112, 196, 9}, {250, 208, 146}, {255, 255, 255}},
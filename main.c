@@ -1,5 +1,5 @@
+#define _GNU_SOURCE
 #define _USE_MATH_DEFINES
-#define M_SQRT3 1.73205080756887729352744634151
 
 #include <assert.h>
 #include <float.h>
@@ -9,495 +9,275 @@
 #include <stdlib.h>
 #include <time.h>
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#include "stb_image_resize2.h"
-
 #define MAX(x, y)	((x) > (y) ? (x) : (y))
 #define MIN(x, y)	((x) < (y) ? (x) : (y))
 #define LENGTH(a)	(sizeof(a) / sizeof(a[0]))
 
+#define ATTRACTOR_IMPLEMENTATION
+#include "attractor.h"
 #include "platform.h"
 #include "cmdline.h"
-#include "gradient.h"
+#include "database.h"
+#include "pool.h"
+#include "video.h"
 
+// entry_count is set before the jobs start, next_entry is claimed with
+// interlocked_increment and back counts finished entries
 struct work_queue_info {
-	volatile int next_entry;
-	volatile int entry_count;
-	volatile int back;
+	atomic_long next_entry;
+	atomic_long entry_count;
+	atomic_long back;
 };
 
+// run callback on every pool thread at once, each claims work from its arg
 static void run_jobs(thread_callback callback, thread_arg arg)
 {
-	// create threads
-	thread_handle *threads = malloc(sizeof(thread_handle) * THREADS);
-	for (int i = 0; i < THREADS; ++i)
-		threads[i] = create_thread(callback, arg);
-
-	// wait for the work to be done
-	wait_for_multiple_threads(threads, THREADS);
-
-	// close the thread handless
-	for (int i = 0; i < THREADS; ++i)
-		close_thread(threads[i]);
-	free(threads);
+	struct task_group group;
+	pool_group(&group);
+	for (int i = 0; i < MAX(1, THREADS); ++i)
+		pool_submit(&group, callback, arg);
+	pool_wait(&group);
 }
 
-long long unsigned CUTOFF = 10000, ITERATIONS;
-
-typedef double coef[8][2];
-typedef double vec[2];
+// the settings given on the command line
+static struct render_settings settings;
+static struct attractor_context *context;
 
-struct config {
-	coef c;
-	vec x_min, x_max, v_max;
-	enum colour_type colour;
-};
-
-static vec u[3] = {
-	{1, 0},
-	{-1.0 / 2, M_SQRT3 / 2},
-	{-1.0 / 2, -M_SQRT3 / 2},
-};
-
-static double dot(vec x, vec y)
+static bool is_valid(enum attractor_type type, coef c)
 {
-	double s = 0;
-	for (int i = 0; i < 2; ++i)
-		s += x[i] * y[i];
-	return s;
+	struct config tmp;
+	tmp.type = type;
+	memcpy(tmp.c, c, sizeof(coef));
+	return attractor_validate(&tmp);
 }
 
-static double dst(vec x0, vec x1)
-{
-	double s = 0;
-	for (int i = 0; i < 2; ++i) {
-		double d = x1[i] - x0[i];
-		s += d * d;
-	}
-	return sqrt(s);
-}
+static struct database db;
 
-static double mag(vec x)
+static void config_to_record(struct config *conf, struct db_record *r)
 {
-	double d = dot(x, x);
-	return sqrt(d);
+	memcpy(r->c, conf->c, sizeof(coef));
+	memcpy(r->x_min, conf->x_min, sizeof(vec));
+	memcpy(r->x_max, conf->x_max, sizeof(vec));
+	memcpy(r->v_max, conf->v_max, sizeof(vec));
+	memcpy(r->seed, conf->seed, sizeof(vec));
+	r->lyapunov = conf->lyapunov;
+	r->score = conf->score;
 }
 
-static double triangle(double x)
+static void record_to_config(struct db_record *r, struct config *conf)
 {
-	return 1 - 4 * fabs(x - floor(x + 0.5));
+	conf->type = TYPE;	// the database only holds TYPE attractors
+	memcpy(conf->c, r->c, sizeof(coef));
+	memcpy(conf->x_min, r->x_min, sizeof(vec));
+	memcpy(conf->x_max, r->x_max, sizeof(vec));
+	memcpy(conf->v_max, r->v_max, sizeof(vec));
+	memcpy(conf->seed, r->seed, sizeof(vec));
+	conf->seeded = true;
+	conf->lyapunov = r->lyapunov;
+	conf->score = r->score;
 }
 
-static double saw(double x)
-{
-	return 1 - 2 * (x - floor(x));
-}
+// coefficients are drawn from [-2, 2], learnt distributions bin that range
+#define BINS 32
+#define KNOWN_COUNT 256
+static const double EXPLORE = 0.1;	// share of draws kept uniform as a baseline
+static const double MUTATION = 0.05;
+
+struct search_model {
+	unsigned magic;
+	int type, cn;
+	double hist[8][2][BINS];
+};
+
+static struct {
+	struct search_model model;
+	coef known[KNOWN_COUNT];	// ring of attractors accepted this run
+	int known_count;
+	long long tried[SEARCH_COUNT], accepted[SEARCH_COUNT];
+	double cpu;
+	mutex_handle lock;	// random_config() is called from several threads
+} search;
 
-static void iteration(coef c, vec y)
+static double uniform(double lo, double hi)
 {
-#if 1
-	vec z;
-	for (int i = 0; i < 2; ++i)
-		switch (TYPE) {
-			case AT_POLY:
-				z[i] =
-					c[0][i] +
-					c[1][i] * y[0] +
-					c[2][i] * y[0] * y[0] +
-					c[3][i] * y[0] * y[1] +
-					c[4][i] * y[1] * y[1] +
-					c[5][i] * y[1];
-				break;
-			case AT_TRIG:
-				z[i] =
-					c[0][i] * sin(c[1][i] * y[1]) +
-					c[2][i] * cos(c[3][i] * y[0]) +
-					c[4][i] * sin(c[5][i] * y[0]) +
-					c[6][i] * cos(c[7][i] * y[1]);
-				break;
-			case AT_SAW:
-				z[i] =
-					c[0][i] * saw(c[1][i] * y[1]) +
-					c[2][i] * saw(c[3][i] * y[0] + 0.5) +
-					c[4][i] * saw(c[5][i] * y[0]) +
-					c[6][i] * saw(c[7][i] * y[1] + 0.5);
-				break;
-			case AT_TRI:
-				z[i] =
-					c[0][i] * triangle(c[1][i] * y[1]) +
-					c[2][i] * triangle(c[3][i] * y[0] + 0.5) +
-					c[4][i] * triangle(c[5][i] * y[0]) +
-					c[6][i] * triangle(c[7][i] * y[1] + 0.5);
-				break;
-		}
-#else
-#define Y(i) (i < 2 ? y[i] : 1)
-	vec z = {0, 0};
-	for (int i = 0; i < 2; ++i) {
-		int a = 0;
-		for (int j = 0; j < 2 + 1; ++j)
-			for (int k = j; k < 2 + 1; ++k)
-				z[i] += c[a++][i] * Y(j) * Y(k);
-	}
-#endif
-	for (int i = 0; i < 2; ++i)
-		y[i] = z[i];
+	return lo + (double)rand() / RAND_MAX * (hi - lo);
 }
 
-// find a set of coefficients to generate a strange attractor
-static bool attractor(struct config *conf)
+static double normal(void)
 {
-	// initialize parameters
-	vec x = {0};
-	vec xe = {1e-3};	// for lyapunov exponent
-	double d0 = dst(x, xe);
-	vec v;
-
-	for (int i = 0; i < 2; ++i) {
-		conf->x_min[i] = 1e10;
-		conf->x_max[i] = -1e10;
-		conf->v_max[i] = 0;
-	}
-
-	double lyapunov = 0;
-	for (unsigned n = 0; n < CUTOFF * 2; ++n) {
-		vec x_last;
-		for (int i = 0; i < 2; ++i)
-			x_last[i] = x[i];
-
-		iteration(conf->c, x);
-		iteration(conf->c, xe);
-
-		// converge, diverge
-		for (int i = 0; i < 2; ++i)
-			if (fabs(x[i]) > 1e10 || fabs(x[i]) < 1e-10)
-				return false;
-		if (n > CUTOFF) {
-			for (int i = 0; i < 2; ++i) {
-				v[i] = x[i] - x_last[i];
-				conf->x_max[i] = MAX(conf->x_max[i], x[i]);
-				conf->x_min[i] = MIN(conf->x_min[i], x[i]);
-				conf->v_max[i] = MAX(fabs(v[i]), conf->v_max[i]);
-			}
-			// lyapunov exponent
-			double d = dst(x, xe);
-			lyapunov += log(fabs(d / d0));
-		}
-	}
-	return lyapunov / CUTOFF > 5;
+	double u = ((double)rand() + 1) / ((double)RAND_MAX + 1);
+	return sqrt(-2 * log(u)) * cos(2 * M_PI * uniform(0, 1));
 }
 
-static bool is_valid(coef c)
+static void init_model(void)
 {
-	struct config tmp;
-	memcpy(tmp.c, c, sizeof(coef));
-	return attractor(&tmp);
+	memset(&search.model, 0, sizeof(search.model));
+	search.model.magic = 0x4c444d41; // "AMDL"
+	search.model.type = TYPE;
+	search.model.cn = CN;
+	for (int j = 0; j < 8; ++j)
+		for (int i = 0; i < 2; ++i)
+			for (int b = 0; b < BINS; ++b)
+				search.model.hist[j][i][b] = 1;
 }
 
-static void random_config(struct config *conf)
+static void load_model(void)
 {
-	printf("\rfinding attractor parameters");
-	conf->colour = COLOUR;
-	do {
-		for (int i = 0; i < 2; ++i)
-			for (int j = 0; j < CN; ++j)
-				conf->c[j][i] = (double)rand() / RAND_MAX * 4 - 2;
-	} while (attractor(conf) == false);
+	init_model();
+	FILE *f = fopen(MODEL, "rb");
+	if (f == NULL)
+		return;
+	struct search_model tmp;
+	if (fread(&tmp, sizeof(tmp), 1, f) == 1 &&
+	    tmp.magic == search.model.magic && tmp.type == TYPE && tmp.cn == CN)
+		memcpy(&search.model, &tmp, sizeof(tmp));
+	else
+		fprintf(stderr, "ignoring %s, it is not a %s model\n", MODEL, attractor_map[TYPE]);
+	fclose(f);
 }
 
-static bool set_config(struct config *conf, const char params[256])
+static void save_model(void)
 {
-	conf->colour = COLOUR;
-	bool result = true;
-	for (int i = 0; i < 2; ++i)
-		for (int j = 0; j < CN; ++j)
-			result &= (bool)sscanf(params + 7 * (i * CN + j), "%lf", &conf->c[j][i]);
-	attractor(conf);
-	return result;
+	FILE *f = fopen(MODEL, "wb");
+	if (f == NULL || fwrite(&search.model, sizeof(search.model), 1, f) != 1)
+		fprintf(stderr, "failed to write %s\n", MODEL);
+	if (f)
+		fclose(f);
 }
 
-static void str_c(coef c, char params[256])
+static void learn(coef c)
 {
 	for (int i = 0; i < 2; ++i)
-		for (int j = 0; j < CN; ++j)
-			sprintf(params + 7 * (i * CN + j), "% 1.3f ", c[j][i]);
+		for (int j = 0; j < CN; ++j) {
+			int b = (int)((c[j][i] + 2) / 4 * BINS);
+			if (b >= 0 && b < BINS)
+				search.model.hist[j][i][b] += 1;
+		}
+	memcpy(search.known[search.known_count++ % KNOWN_COUNT], c, sizeof(coef));
 }
 
-static double srgb(double L)
+static double draw_histogram(double hist[BINS])
 {
-	return L <= 0.0031308 ? L * 12.92
-		: 1.055 * pow(L, 1 / 2.44) - 0.055;
+	double total = 0;
+	for (int b = 0; b < BINS; ++b)
+		total += hist[b];
+	double t = uniform(0, total);
+	int b = 0;
+	while (b < BINS - 1 && t >= hist[b])
+		t -= hist[b++];
+	return -2 + (b + uniform(0, 1)) * 4 / BINS;
 }
 
-static void hsv_to_rgb(double H, double S, double V, double rgb[3])
+static enum search_type draw(coef c)
 {
-	double C = V * S;
-	double HH = H / 60;
-	double X = C * (1 - fabs(fmod(HH, 2) - 1));
-	switch ((int)floor(HH)) {
-		case 0:
-			rgb[0] = C;
-			rgb[1] = X;
-			rgb[2] = 0;
-			break;
-		case 1:
-			rgb[0] = X;
-			rgb[1] = C;
-			rgb[2] = 0;
-			break;
-		case 2:
-			rgb[0] = 0;
-			rgb[1] = C;
-			rgb[2] = X;
+	enum search_type s = SEARCH;
+	bool known = search.known_count > 0 || (DB && db.header->count > 0);
+	if (uniform(0, 1) < EXPLORE || (s == SEARCH_MUTATE && !known))
+		s = SEARCH_UNIFORM;
+
+	switch (s) {
+		case SEARCH_UNIFORM:
+			for (int i = 0; i < 2; ++i)
+				for (int j = 0; j < CN; ++j)
+					c[j][i] = uniform(-2, 2);
 			break;
-		case 3:
-			rgb[0] = 0;
-			rgb[1] = X;
-			rgb[2] = C;
+		case SEARCH_HISTOGRAM:
+			for (int i = 0; i < 2; ++i)
+				for (int j = 0; j < CN; ++j)
+					c[j][i] = draw_histogram(search.model.hist[j][i]);
 			break;
-		case 4:
-			rgb[0] = X;
-			rgb[1] = 0;
-			rgb[2] = C;
+		case SEARCH_MUTATE:
+		{
+			// perturb an attractor from this run or from the database
+			struct db_record r;
+			if (DB && db.header->count > 0 && (search.known_count == 0 || rand() % 2)) {
+				db_pick(&db, &r, true);
+				memcpy(c, r.c, sizeof(coef));
+			} else {
+				memcpy(c, search.known[rand() % MIN(search.known_count, KNOWN_COUNT)], sizeof(coef));
+			}
+			for (int i = 0; i < 2; ++i)
+				for (int j = 0; j < CN; ++j)
+					c[j][i] += MUTATION * normal();
 			break;
-		case 5:
-			rgb[0] = C;
-			rgb[1] = 0;
-			rgb[2] = X;
+		}
+		default:
 			break;
 	}
-	double m = V - C;
-	for (int k = 0; k < 3; ++k)
-		rgb[k] = rgb[k] + m;
-}
-
-static void rgb_to_hsv(double r, double g, double b, double *h, double *s, double *v)
-{
-	double x_max = MAX(r, MAX(g, b));
-	double x_min = MIN(r, MIN(g, b));
-	double c = x_max - x_min;
-	*v = x_max;
-	*s = *v == 0 ? 0 : c / *v;
-	*h = c == 0 ?  0 :
-		*v == r ? 60 * ((g - b) / c) :
-		*v == g ? 60 * ((b - r) / c + 2) :
-		60 * ((r - g) / c + 4);
-	*h = *h < 0 ? 360 + *h : *h;
-}
-
-static void hsv_to_hsl(double sv, double v, double *sl, double *l)
-{
-	*l = v * (1 - sv / 2);
-	*sl = *l == 0 || *l == 1 ? 0 : (v - *l) / MIN(*l, 1 - *l);
-}
-
-static void hsl_to_hsv(double sl, double l, double *sv, double *v)
-{
-	*v = l + sl * MIN(l, 1 - l);
-	*sv = *v == 0 ? 0 : 2 * (1 - l / *v);
-}
-
-static void hsl_to_rgb(double h, double s, double l, double rgb[3])
-{
-	double sv, v;
-	hsl_to_hsv(s, l, &sv, &v);
-	hsv_to_rgb(h, sv, v, rgb);
-}
-
-static void rgb_to_hsl(double rgb[3], double *h, double *s, double *l)
-{
-	double sv, v;
-	rgb_to_hsv(rgb[0], rgb[1], rgb[2], h, &sv, &v);
-	hsv_to_hsl(sv, v, s, l);
-}
-
-static void rgb256_to_rgb1(unsigned char rgb256[3], double rgb1[3])
-{
-	for (int k = 0; k < 3; ++k)
-		rgb1[k] = (double)rgb256[k] / 0xff;
-}
-
-static void rgb1_to_rgb256(double rgb1[3], unsigned char rgb256[3])
-{
-	for (int k = 0; k < 3; ++k)
-		rgb256[k] = (unsigned char)(rgb1[k] * 0xff);
-}
-
-static void inv(double rgb[3])
-{
-	for (int k = 0; k < 3; ++k)
-		rgb[k] = 1 - rgb[k];
-}
-
-static void set_brightness(double desired, double rgb1[3], double r[3])
-{
-#if 0
-	double h, s, l;
-	rgb_to_hsl(rgb1, &h, &s, &l);
-	hsl_to_rgb(h, s, desired, r);
-#else
-	double dot = rgb1[0] * rgb1[0] + rgb1[1] * rgb1[1] + rgb1[2] * rgb1[2];
-	double mag = sqrt(dot);
-	if (mag == 0)
-		memcpy(r, rgb1, sizeof(double) * 3);
-	else
-		for (int k = 0; k < 3; ++k) {
-			r[k] = r[k] / mag * sqrt(pow(desired, 2) *3);
-			if (r[k] > 1)
-				r[k] = 1;
-		}
-#endif
+	return s;
 }
 
-static void lerp(double result[3], double left[3], double right[3], double t)
+static void print_search_stats(void)
 {
-	for (int k = 0; k < 3; ++k)
-		result[k] = (1 -t ) * left[k] + t * right[k];
+	long long accepted = 0;
+	for (int s = 0; s < SEARCH_COUNT; ++s) {
+		if (search.tried[s] == 0)
+			continue;
+		printf("%s accepted %lld/%lld (%.2f%%)\n", search_map[s], search.accepted[s], search.tried[s],
+		       100.0 * search.accepted[s] / search.tried[s]);
+		accepted += search.accepted[s];
+	}
+	if (accepted)
+		printf("%.1f attractors per cpu second\n", accepted / search.cpu);
 }
 
-#define BUF(i, j, k) buf[(i) * WIDTH * 3 + (j) * 3 + (k)]
-#define BIG_BUF(i, j, k) big_buf[(i) * D_WIDTH * 3 + (j) * 3 + (k)]
-#define INFO(i, j, k) info[(i) * D_WIDTH * 4 + (j) * 4 + (k)]
-
-static void render_image(struct config *conf, unsigned char *buf)
+static void random_config(struct config *conf)
 {
-	unsigned char bg = LIGHT ? 0xff : 0;
-	int D_WIDTH = WIDTH * DOWNSCALE, D_HEIGHT = HEIGHT * DOWNSCALE;
-	unsigned char *big_buf = DOWNSCALE > 1 ?
-		malloc(sizeof(char) * D_HEIGHT * D_WIDTH * 3) :
-		buf;
-	memset(big_buf, bg, sizeof(char) * D_HEIGHT * D_WIDTH * 3);
-	double *info = calloc(1, sizeof(double) * D_HEIGHT * D_WIDTH * 4);
+	conf->type = TYPE;
+	conf->colour = COLOUR;
 
-	vec x = {0};
-	for (unsigned n = 0; n < CUTOFF; ++n)
-		iteration(conf->c, x);
-
-	double range[2] = {conf->x_max[0] - conf->x_min[0], conf->x_max[1] - conf->x_min[1]};
-	int o = range[0] < range[1];
-	double x_scale = (D_WIDTH - 1) / (conf->x_max[o] - conf->x_min[o]) * (1 - BORDER);
-	double y_scale = (D_HEIGHT - 1) / (conf->x_max[!o] - conf->x_min[!o]) * (1 - BORDER);
-	if (!STRETCH) {
-		if (x_scale > y_scale)
-			x_scale = y_scale;
-		else
-			y_scale = x_scale;
+	// previously validated attractors don't need searching for
+	struct db_record r;
+	lock_mutex(search.lock);
+	bool picked = FROM_DB && db_pick(&db, &r, FROM_DB == 2);
+	unlock_mutex(search.lock);
+	if (picked) {
+		record_to_config(&r, conf);
+		return;
 	}
 
-	unsigned count = 0;
-	for (long long unsigned n = CUTOFF; n < ITERATIONS; ++n) {
-		vec x_last;
-		vec v;
-		for (int i = 0; i < 2; ++i)
-			x_last[i] = x[i];
-		iteration(conf->c, x);
-		for (int i = 0; i < 2; ++i)
-			v[i] = x[i] - x_last[i];
-
-		int i = (int)((D_HEIGHT - range[!o] * y_scale) / 2 + (x[!o] - conf->x_min[!o]) * y_scale);
-		int j = (int)((D_WIDTH  - range[ o] * x_scale) / 2 + (x[ o] - conf->x_min[ o]) * x_scale);
-		if (i < 0 || i >= D_HEIGHT) continue;
-		if (j < 0 || j >= D_WIDTH) continue;
-
-		count += INFO(i, j, 0) == 0;
-		INFO(i, j, 0) += 1;
-		switch (conf->colour) {
-			case HSV:
-			case HSL:
-				vec w = {v[1] / conf->v_max[1], v[0] / conf->v_max[0]};
-				double m = mag(w);
-				INFO(i, j, 1) += w[1] / m;
-				INFO(i, j, 2) += w[0] / m;
-				break;
-			case MIX:
-				for (int k = 0; k < 3; ++k)
-					INFO(i, j, k + 1) += fabs(dot(u[k], v)) / sqrt(dot(conf->v_max, conf->v_max));
-				break;
-			case RGB:
-				INFO(i, j, 1) += MAX(0, v[0] / conf->v_max[0]);
-				INFO(i, j, 2 + LIGHT) += MAX(0, -v[0] / conf->v_max[0]);
-				INFO(i, j, 3 - LIGHT) += fabs(v[1]) / conf->v_max[1];
-				break;
-			default:
+	double start = thread_cpu_time();
+	struct config best = {.score = -1};
+	for (int k = 0; k < MAX(1, CANDIDATES); ++k) {
+		for (;;) {
+			// only the draw and the bookkeeping need the lock
+			lock_mutex(search.lock);
+			enum search_type s = draw(conf->c);
+			++search.tried[s];
+			unlock_mutex(search.lock);
+			if (attractor_validate(conf) && conf->score >= MIN_SCORE) {
+				lock_mutex(search.lock);
+				++search.accepted[s];
+				unlock_mutex(search.lock);
 				break;
+			}
 		}
+		lock_mutex(search.lock);
+		learn(conf->c);
+		unlock_mutex(search.lock);
+		if (conf->score > best.score)
+			memcpy(&best, conf, sizeof(struct config));
 	}
-	double DENSITY = (double)ITERATIONS / count;
-
-	for (int i = 0; i < D_HEIGHT; ++i)
-		for (int j = 0; j < D_WIDTH; ++j) {
-			if (INFO(i, j, 0) == 0)
-				continue;
-			double v = INTENSITY / DENSITY * INFO(i, j, 0) / 0xff;
-			v = MIN(1, conf->colour == HSV ? v * 2 : v);
-			v = sqrt(v);
-			switch (conf->colour) {
-				case HSV:
-				case HSL:
-				{
-					double h = 180 + atan2(INFO(i, j, 1), INFO(i, j, 2)) * 180 / M_PI;
-					double s = mag((double *)&INFO(i, j, 1)) / INFO(i, j, 0);
-					double rgb[3];
-					(conf->colour == HSV ? hsv_to_rgb : hsl_to_rgb)(h, s, v, rgb);
-					if (LIGHT) inv(rgb);
-					rgb1_to_rgb256(rgb, &BIG_BUF(i, j, 0));
-					break;
-				}
-				case BW:
-				{
-					for (int k = 0; k < 3; ++k)
-						BIG_BUF(i, j, k) = (char)((LIGHT ? 1 - v : v) * 0xff);
-					break;
-				}
-				case MIX:
-				case RGB:
-				{
-					double rgb[3];
-					for (int k = 0; k < 3; ++k)
-						rgb[k] = MIN(1, INFO(i, j, k + 1) * INTENSITY / DENSITY/ 0xff);
-					set_brightness(v, rgb, rgb);
-					if (LIGHT) inv(rgb);
-					rgb1_to_rgb256(rgb, &BIG_BUF(i, j, 0));
-					break;
-				}
-				// gradient map
-				default:
-				{
-					double g = (LIGHT ? 1 - v : v) * (GN - 1);
-					double t = fmod(g, 1);
-					int l = (int)floor(g), r = (int)ceil(g);
-					double rgb[3];
-					lerp(rgb, gradients[conf->colour][l], gradients[conf->colour][r], t);
-					for (int k = 0; k < 3; ++k)
-						BIG_BUF(i, j, k) = (char)rgb[k];
-					break;
-				}
-			}
+	memcpy(conf, &best, sizeof(struct config));
+
+	lock_mutex(search.lock);
+	search.cpu += thread_cpu_time() - start;
+	if (DB) {
+		config_to_record(conf, &r);
+		if (!db_append(&db, &r)) {
+			fprintf(stderr, "failed to append to %s\n", db.name);
+			exit(1);
 		}
-
-	if (DOWNSCALE >  1) {
-		stbir_resize_uint8_srgb((unsigned char *)big_buf, D_WIDTH, D_HEIGHT, D_WIDTH * sizeof(char) * 3,
-		                        (unsigned char *)buf, WIDTH, HEIGHT, WIDTH * sizeof(char) * 3,
-		                        STBIR_RGB);
-		free(big_buf);
 	}
-	free(info);
-
-#if 0
-	// write debug gradient map
-	for (int j = 0; j < MIN(600, D_HEIGHT); ++j) {
-		double v = (double)j / 600 * (GN - 1);
-		double t = fmod(v, 1);
-		int l = (int)floor(v);
-		int r = (int)ceil(v);
-		for (int i = 0; i < 20; ++i)
-			for (int k = 0; k < 3; ++k)
-				BUF(i, j, k) = (char)((1 - t) * gradients[conf->colour][l][k] + t * gradients[conf->colour][r][k]);
+	unlock_mutex(search.lock);
+}
 
-	}
-#endif
+// lines without a type or colour use the command line's
+static bool set_config(struct config *conf, struct render_settings *rs, const char *line)
+{
+	conf->colour = COLOUR;
+	conf->type = TYPE;
+	return attractor_parse(conf, rs, line);
 }
 
 static void progress(int i, int max, time_t elapsed)
@@ -509,7 +289,14 @@ static void progress(int i, int max, time_t elapsed)
 
 static int write_image(char *name, int width, int height, void *buf)
 {
-	int result = stbi_write_png(name, width, height, 3, buf, width * sizeof(char) * 3);
+	size_t size = attractor_png_bound(width, height);
+	unsigned char *png = malloc(size);
+	size_t len = attractor_encode_png(buf, width, height, png, size);
+	FILE *f = len ? fopen(name, "wb") : NULL;
+	int result = f && fwrite(png, len, 1, f) == 1;
+	if (f)
+		fclose(f);
+	free(png);
 	if (!result)
 		printf("failed to write %s\n", name);
 	else
@@ -524,62 +311,138 @@ struct write_samples_arg {
 	int w, h;
 	char *buf;
 	time_t start;
+
+	// when searching, configs are rendered as soon as they are found, found
+	// but unrendered cells wait in a bounded ring of cell indices
+	bool search;
+	mutex_handle lock;
+	event_handle event;	// set while the ring has cells or everything is claimed
+	int *queue;
+	int queue_size, queue_front, queue_len;
+	int searched, searching, popped;
 };
 
+static void write_sample(struct write_samples_arg *arg, int s, unsigned char *buf)
+{
+	int i = s / arg->n;
+	int j = s % arg->n;
+	attractor_render(context, &settings, &arg->config_array[s], buf);
+	for (int k = 0; k < HEIGHT; ++k)
+#define SBUF(i, j, k) arg->buf[(i) * arg->w * 3 + (j) * 3 + (k)]
+		memcpy(&SBUF(i * HEIGHT + k, j * WIDTH, 0), &buf[k * WIDTH * 3], sizeof(char) * WIDTH * 3);
+
+	int b = interlocked_increment(&arg->thread_info.back);
+	progress(b, atomic_read(&arg->thread_info.entry_count), time(NULL) - arg->start);
+}
+
+// every worker renders a found cell if there is one, otherwise searches for
+// the next cell while there is room in the ring
+static void search_samples_callback(struct write_samples_arg *arg, unsigned char *buf)
+{
+	for (;;) {
+		lock_mutex(arg->lock);
+		if (arg->queue_len > 0) {
+			int s = arg->queue[arg->queue_front];
+			arg->queue_front = (arg->queue_front + 1) % arg->queue_size;
+			--arg->queue_len;
+			++arg->popped;
+			if (arg->queue_len == 0 && arg->popped < atomic_read(&arg->thread_info.entry_count))
+				reset_event(arg->event);
+			else if (arg->popped == atomic_read(&arg->thread_info.entry_count))
+				set_event(arg->event);
+			unlock_mutex(arg->lock);
+			write_sample(arg, s, buf);
+		} else if (arg->searched < atomic_read(&arg->thread_info.entry_count) &&
+		           arg->searching + arg->queue_len < arg->queue_size) {
+			int s = arg->searched++;
+			++arg->searching;
+			unlock_mutex(arg->lock);
+
+			random_config(&arg->config_array[s]);
+
+			lock_mutex(arg->lock);
+			--arg->searching;
+			arg->queue[(arg->queue_front + arg->queue_len++) % arg->queue_size] = s;
+			set_event(arg->event);
+			unlock_mutex(arg->lock);
+		} else if (arg->popped == atomic_read(&arg->thread_info.entry_count)) {
+			unlock_mutex(arg->lock);
+			return;
+		} else {
+			unlock_mutex(arg->lock);
+			wait_for_event(arg->event);
+		}
+	}
+}
 
 static void write_samples_callback(void *arg_)
 {
 	struct write_samples_arg *arg = (struct write_samples_arg *)arg_;
 	unsigned char *buf = malloc(sizeof(char) * HEIGHT * WIDTH * 3);
 
-	while (arg->thread_info.next_entry < arg->thread_info.entry_count) {
-		int s = interlocked_increment((long *)&arg->thread_info.next_entry) - 1;
-		if (s >= arg->thread_info.next_entry)
-			break;
-
-		int i = s / arg->n;
-		int j = s % arg->n;
-		render_image(&arg->config_array[s], buf);
-		for (int k = 0; k < HEIGHT; ++k)
-#define SBUF(i, j, k) arg->buf[(i) * arg->w * 3 + (j) * 3 + (k)]
-			memcpy(&SBUF(i * HEIGHT + k, j * WIDTH, 0), &BUF(k, 0, 0), sizeof(char) * WIDTH * 3);
-
-		int b = interlocked_increment((long *)&arg->thread_info.back);
-		progress(b, arg->thread_info.entry_count, time(NULL) - arg->start);
-	}
+	if (arg->search)
+		search_samples_callback(arg, buf);
+	else
+		for (;;) {
+			int s = interlocked_increment(&arg->thread_info.next_entry) - 1;
+			if (s >= atomic_read(&arg->thread_info.entry_count))
+				break;
+			write_sample(arg, s, buf);
+		}
 
 	free(buf);
 }
 
-static int write_samples(char name[], struct config *config_array, int samples)
+static void write_samples_txt(char name[], struct config *config_array, int samples)
 {
-	int n = (int)ceil(sqrt((double)samples));
-	int w = WIDTH * n;
-	int h = HEIGHT * n;
-	char *buf = (char *)malloc(sizeof(char) * w * h * 3);
-	memset(buf, 0x7f, sizeof(char) * w * h * 3);
-
 	char txt[256];
 	snprintf(txt, 256, "%s%s.txt", OUT_DIR, name);
 	FILE *f = fopen(txt, "w");
 	for (int s = 0; s < samples; ++s) {
-		char params[256];
-		str_c(config_array[s].c, params);
+		char params[PARAMS_LEN];
+		attractor_format(&config_array[s], params);
 		fprintf(f, "%s # %d\n", params, 1 + s);
 	}
 	fclose(f);
+}
+
+// render configs into a grid, searching for them first if search is set
+static int write_samples(char name[], struct config *config_array, int samples, bool search)
+{
+	int n = (int)ceil(sqrt((double)samples));
+	int w = WIDTH * n;
+	int h = HEIGHT * n;
+	char *buf = (char *)malloc(sizeof(char) * w * h * 3);
+	memset(buf, 0x7f, sizeof(char) * w * h * 3);
+
+	if (!search)
+		write_samples_txt(name, config_array, samples);
 
 	struct write_samples_arg arg = {0};
-	arg.thread_info.entry_count = samples;
+	atomic_write(&arg.thread_info.entry_count, samples);
 	arg.config_array = config_array;
 	arg.n = n;
 	arg.w = w;
 	arg.h = h;
 	arg.buf = buf;
 	arg.start = time(NULL);
+	arg.search = search;
+	if (search) {
+		arg.lock = create_mutex();
+		arg.event = create_event();
+		arg.queue_size = MAX(1, THREADS) * 2;
+		arg.queue = malloc(sizeof(int) * arg.queue_size);
+	}
 	run_jobs(write_samples_callback, (void *)&arg);
 	putchar('\n');
 
+	if (search) {
+		write_samples_txt(name, config_array, samples);
+		free(arg.queue);
+		close_event(arg.event);
+		close_mutex(arg.lock);
+	}
+
 	char png[256];
 	snprintf(png, 256, "%s%s.png", OUT_DIR, name);
 	int result = write_image(png, w, h, buf);
@@ -590,59 +453,233 @@ static int write_samples(char name[], struct config *config_array, int samples)
 static void write_attractor(char *name, struct config *conf)
 {
 	unsigned char *buf = malloc(sizeof(char) * HEIGHT * WIDTH * 3);
-	render_image(conf, buf);
+	attractor_render(context, &settings, conf, buf);
 	write_image(name, WIDTH, HEIGHT, buf);
 	free(buf);
 }
 
+static void params_error(long long line, const char *buf)
+{
+	fprintf(stderr, "parse error when reading \"%s\", line %lld:\n", PARAMS, line);
+	fprintf(stderr, "%s\n", buf);
+	fprintf(stderr, "%s should be a %s\n", PARAMS, options[OP_PARAMS].doc);
+	exit(1);
+}
+
+// the params file is mapped and split into chunks of bytes which are the
+// work queue entries, a line belongs to the chunk it starts in
 struct write_attractors_arg {
 	struct work_queue_info thread_info;
-	struct config *config_array;
+	struct mapped_file *file;
+	const char *data;
+	size_t size, chunk_size;
+	long long *first_line;	// number of lines before each chunk
+	bool counting;
 };
 
+static bool line_starts(struct write_attractors_arg *arg, size_t p)
+{
+	return p == 0 || arg->data[p - 1] == '\n';
+}
+
 static void write_attractors_callback(void *arg_)
 {
 	struct write_attractors_arg *arg = (struct write_attractors_arg *)arg_;
-	unsigned char *buf = malloc(sizeof(char) * HEIGHT * WIDTH * 3);
+	// lines can change the image size, the buffer only grows
+	size_t buf_size = 0;
+	unsigned char *buf = NULL;
 
-	while (arg->thread_info.next_entry < arg->thread_info.entry_count) {
-		int s = interlocked_increment((long *)&arg->thread_info.next_entry) - 1;
-		if (s >= arg->thread_info.next_entry)
+	for (;;) {
+		int s = interlocked_increment(&arg->thread_info.next_entry) - 1;
+		if (s >= atomic_read(&arg->thread_info.entry_count))
 			break;
 
-		char name[256];
-		snprintf(name, 256, "%s%d.png", OUT_DIR, s);
-		render_image(&arg->config_array[s], buf);
-		write_image(name, WIDTH, HEIGHT, buf);
+		size_t begin = s * arg->chunk_size;
+		size_t end = MIN(arg->size, begin + arg->chunk_size);
+		if (arg->counting) {
+			long long lines = 0;
+			for (size_t p = begin; p < end; ++p)
+				lines += line_starts(arg, p);
+			arg->first_line[s + 1] = lines;
+			release_mapped(arg->file, begin, end - begin);
+			continue;
+		}
+
+		long long line = arg->first_line[s];
+		for (size_t p = begin; p < end; ++p) {
+			if (!line_starts(arg, p))
+				continue;
+			const char *eol = memchr(arg->data + p, '\n', arg->size - p);
+			size_t len = (eol ? (size_t)(eol - arg->data) : arg->size) - p;
+			char params[PARAMS_LEN];
+			memcpy(params, arg->data + p, MIN(PARAMS_LEN - 1, len));
+			params[MIN(PARAMS_LEN - 1, len)] = '\0';
+			// a cut off line would lose the overrides at its end
+			if (len >= PARAMS_LEN)
+				params_error(line, params);
+
+			// blank lines keep their number but aren't rendered
+			if (strspn(params, " \t\r") != len) {
+				struct config conf;
+				struct render_settings rs = settings;
+				if (!set_config(&conf, &rs, params))
+					params_error(line, params);
+				size_t size = sizeof(char) * rs.height * rs.width * 3;
+				if (size > buf_size) {
+					free(buf);
+					buf = malloc(buf_size = size);
+				}
+				char name[256];
+				snprintf(name, 256, "%s%lld.png", OUT_DIR, line);
+				attractor_render(context, &rs, &conf, buf);
+				write_image(name, rs.width, rs.height, buf);
+			}
+			++line;
+			p += len;
+		}
+		release_mapped(arg->file, begin, end - begin);
 	}
 
 	free(buf);
 }
 
-static void write_attractors(struct config *config_array, int count)
+// render every line of the params file, memory use doesn't depend on the
+// number of lines
+static void write_attractors(void)
 {
+	struct mapped_file file;
+	if (!map_file_readonly(&file, PARAMS)) {
+		fprintf(stderr, "option error: -params could not open \"%s\"\n", PARAMS);
+		exit(1);
+	}
+
 	struct write_attractors_arg arg = {0};
-	arg.thread_info.entry_count = count;
-	arg.config_array = config_array;
+	arg.file = &file;
+	arg.data = file.data;
+	arg.size = file.size;
+	arg.chunk_size = MAX(4096, file.size / (MAX(1, THREADS) * 64) + 1);
+	int chunks = (int)((file.size + arg.chunk_size - 1) / arg.chunk_size);
+	arg.first_line = calloc(chunks + 1, sizeof(long long));
+
+	// count the lines starting in each chunk, then number them
+	arg.counting = true;
+	atomic_write(&arg.thread_info.entry_count, chunks);
 	run_jobs(write_attractors_callback, (void *)&arg);
+	for (int s = 0; s < chunks; ++s)
+		arg.first_line[s + 1] += arg.first_line[s];
+
+	arg.counting = false;
+	atomic_write(&arg.thread_info.next_entry, 0);
+	run_jobs(write_attractors_callback, (void *)&arg);
+
+	free(arg.first_line);
+	unmap_file(&file);
 }
 
 static void sample_attractor(int samples)
 {
 	struct config *config_array = (struct config *)malloc(sizeof(struct config) * samples);
+	puts("finding attractor parameters");
+	write_samples("samples", config_array, samples, true);
+	free(config_array);
+}
 
-	for (int s = 0; s < samples; ++s)
-		random_config(&config_array[s]);
-	putchar('\n');
+struct video_bounds_arg {
+	struct config *config_array;
+	bool *valid;
+	int frames, stride;
+};
 
-	write_samples("samples", config_array, samples);
-	free(config_array);
+// validating a frame also seeds it, so its render starts on the attractor
+static void video_bounds_body(void *arg_, int s)
+{
+	struct video_bounds_arg *arg = (struct video_bounds_arg *)arg_;
+	int i = MIN(arg->frames - 1, s * arg->stride);
+	arg->valid[i] = attractor_validate(&arg->config_array[i]);
+}
+
+static bool is_sampled(int i, int frames, int stride)
+{
+	return i % stride == 0 || i == frames - 1;
+}
+
+// spread the frames from START to END and validate every stride frames and
+// the last frame, the frames in between take the verdict and velocity bound
+// of the sample before them
+static void video_frames(const char *params, struct config *config_array, bool *valid, int frames, int stride)
+{
+	double dt = (END - START) / frames;
+	set_config(&config_array[0], NULL, params);
+	config_array[0].c[CJ][CI] += START;
+	config_array[0].seeded = false;
+	for (int i = 1; i < frames; ++i) {
+		memcpy(&config_array[i], &config_array[0], sizeof(struct config));
+		config_array[i].c[CJ][CI] += dt * i;
+	}
+
+	struct video_bounds_arg arg = {config_array, valid, frames, stride};
+	pool_for((frames - 1 + stride - 1) / stride + 1, 1, video_bounds_body, (void *)&arg);
+
+	for (int i = 1; i < frames; ++i)
+		if (!is_sampled(i, frames, stride)) {
+			valid[i] = valid[i - 1];
+			memcpy(config_array[i].v_max, config_array[i - 1].v_max, sizeof(vec));
+		}
 }
 
-static void set_video_params(const char *params, struct config *config_array, int frames)
+static void invalid_frames_error(struct config *config_array, bool *valid, int frames)
 {
-	double range = END - START;
-	double dt = range / frames;
+	fprintf(stderr, "frames that aren't chaotic:");
+	for (int i = 0; i < frames; ++i) {
+		if (valid[i])
+			continue;
+		int j = i;
+		while (j + 1 < frames && !valid[j + 1])
+			++j;
+		if (i == j)
+			fprintf(stderr, " %d (%c%d %.3f)", i, "xy"[CI], CJ, config_array[i].c[CJ][CI]);
+		else
+			fprintf(stderr, " %d-%d (%c%d %.3f to %.3f)", i, j, "xy"[CI], CJ,
+			        config_array[i].c[CJ][CI], config_array[j].c[CJ][CI]);
+		i = j;
+	}
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+// bounds sampled from every stride frames get this fraction of their range
+// added on each side for the frames in between
+#define BOUNDS_MARGIN 0.05
+
+// returns the number of frames left once invalid frames have been dealt with
+static int set_video_params(const char *params, struct config *config_array, int frames)
+{
+	// unsampled frames take the verdict of the sample before them, which
+	// could hide an invalid frame from FAIL
+	int stride = INVALID_FRAMES == INVALID_FAIL ? 1 : MAX(1, BOUNDS_STRIDE);
+	bool *valid = malloc(sizeof(bool) * frames);
+	video_frames(params, config_array, valid, frames, stride);
+
+	int first = 0, last = frames - 1;
+	while (first < frames && !valid[first])
+		++first;
+	while (last > first && !valid[last])
+		--last;
+	bool all_valid = first == 0 && last == frames - 1;
+	for (int i = first; i <= last && all_valid; ++i)
+		all_valid = valid[i];
+
+	if (!all_valid && INVALID_FRAMES == INVALID_FAIL)
+		invalid_frames_error(config_array, valid, frames);
+	// spread the frames over the valid part of the range instead
+	if (first < frames && (first > 0 || last < frames - 1) && INVALID_FRAMES == INVALID_TRIM) {
+		double dt = (END - START) / frames;
+		double start = START + dt * first;
+		END = START + dt * (last + 1);
+		START = start;
+		printf("trimmed to -start %.3f -end %.3f\n", START, END);
+		video_frames(params, config_array, valid, frames, stride);
+	}
 
 	vec x_max;
 	vec x_min;
@@ -650,104 +687,218 @@ static void set_video_params(const char *params, struct config *config_array, in
 		x_min[i] = 1e10;
 		x_max[i] = -1e10;
 	}
-
-	set_config(&config_array[0], params);
-	config_array[0].c[CJ][CI] += START;
-	for (int i = 1; i < frames; ++i) {
-		memcpy(&config_array[i], &config_array[0], sizeof(struct config));
-		config_array[i].c[CJ][CI] += dt * i;
-		attractor(&config_array[i]);
-
+	for (int i = 0; i < frames; ++i)
+		if (valid[i] && is_sampled(i, frames, stride))
+			for (int j = 0; j < 2; ++j) {
+				x_max[j] = MAX(x_max[j], config_array[i].x_max[j]);
+				x_min[j] = MIN(x_min[j], config_array[i].x_min[j]);
+			}
+	if (stride > 1)
 		for (int j = 0; j < 2; ++j) {
-			x_max[j] = MAX(x_max[j], config_array[i].x_max[j]);
-			x_min[j] = MIN(x_min[j], config_array[i].x_min[j]);
+			double margin = (x_max[j] - x_min[j]) * BOUNDS_MARGIN;
+			x_max[j] += margin;
+			x_min[j] -= margin;
 		}
-	}
 
+	// leave out the frames that are still invalid
+	int count = 0;
 	for (int i = 0; i < frames; ++i)
+		if (valid[i]) {
+			if (count != i)
+				memcpy(&config_array[count], &config_array[i], sizeof(struct config));
+			++count;
+		}
+	free(valid);
+	if (count == 0) {
+		fprintf(stderr, "no frame between -start %.3f and -end %.3f is chaotic\n", START, END);
+		exit(1);
+	}
+	if (count < frames)
+		printf("left out %d frames that aren't chaotic\n", frames - count);
+
+	for (int i = 0; i < count; ++i)
 		for (int j = 0; j < 2; ++j) {
 			config_array[i].x_max[j] = x_max[j];
 			config_array[i].x_min[j] = x_min[j];
 		}
+	return count;
 }
 
 static void video_preview(const char *params, int samples)
 {
 	struct config *config_array = malloc(sizeof(struct config) * samples);
-	set_video_params(params, config_array, samples);
-	write_samples("preview", config_array, samples);
+	samples = set_video_params(params, config_array, samples);
+	write_samples("preview", config_array, samples, false);
 	free(config_array);
 }
 
+// frames are handed out in runs of VIDEO_RUN, so a worker can carry the orbit
+// from one frame to the next or iterate the whole run in lanes, encoded for
+// the sink into a ring of buffers and written out in order by a writer thread. a slow
+// frame only holds up workers that are a whole ring ahead of it. frame s goes
+// in slot s % ring_size
+#define VIDEO_RUN 4
+
+// a run is only rendered in lanes up to this many pixels a frame, as the
+// accumulators of the whole run are alive at once. at 35 bytes a pixel that's
+// up to 73MB a worker, as much as one 1080p frame rendered on its own. TRIG
+// isn't, its sin and cos calls don't vectorise and it ends up slower than one
+// frame at a time
+#define LANE_PIXELS (1 << 19)
+
 struct write_video_arg {
-	struct work_queue_info thread_info;
+	struct work_queue_info thread_info;	// next_entry counts runs
 	struct config *config_array;
+	int frames;
 	time_t start;
-	FILE *pipe;
-	event_handle event;
+	struct video_sink sink;
+	bool lanes;
+	int ring_size;	// a multiple of VIDEO_RUN
+	size_t frame_size;	// most bytes an encoded frame can take
+	size_t slot_size;	// frame_size rounded up to whole pages
+	unsigned char *ring;
+	size_t *slot_length;	// of the frame encoded into each slot
+	long long *run_end;	// bytes written up to the end of each run of the ring
+	atomic_long *slot_done;	// the last frame rendered into each slot
+	semaphore_handle run_free;	// posted for every free run of slots
+	semaphore_handle rendered;	// posted for every rendered frame
 };
 
 static void write_video_callback(void *arg_)
 {
 	struct write_video_arg *arg = (struct write_video_arg *)arg_;
-	unsigned char *buf = malloc(sizeof(char) * HEIGHT * WIDTH * 3);
-
-	while (arg->thread_info.next_entry < arg->thread_info.entry_count) {
-		int s = interlocked_increment((long *)&arg->thread_info.next_entry) - 1;
-		if (s >= arg->thread_info.next_entry)
+	size_t rgb_size = sizeof(char) * HEIGHT * WIDTH * 3;
+	unsigned char *rgb_run = malloc(rgb_size * VIDEO_RUN);
+
+	for (;;) {
+		// the slots are taken before the run is claimed, so the run a ring
+		// earlier has always been written out
+		wait_for_semaphore(arg->run_free);
+		int r = interlocked_increment(&arg->thread_info.next_entry) - 1;
+		if (r >= atomic_read(&arg->thread_info.entry_count)) {
+			post_semaphore(arg->run_free);
 			break;
+		}
 
-		render_image(&arg->config_array[s], buf);
+		// lanes carry an unseeded frame on from where the one before started
+		// rather than ended, so such runs go one frame at a time to render the
+		// same either way
+		int first = r * VIDEO_RUN, end = MIN(arg->frames, first + VIDEO_RUN);
+		bool seeded = true;
+		for (int s = first; s < end; ++s)
+			seeded = seeded && arg->config_array[s].seeded;
+		if (arg->lanes && seeded) {
+			unsigned char *rgb[VIDEO_RUN];
+			for (int s = first; s < end; ++s)
+				rgb[s - first] = rgb_run + (s - first) * rgb_size;
+			attractor_render_lanes(context, &settings, &arg->config_array[first], end - first, rgb);
+		} else {
+			vec orbit;
+			for (int s = first; s < end; ++s)
+				attractor_render_from(context, &settings, &arg->config_array[s], rgb_run + (s - first) * rgb_size,
+				                      orbit, s > first);
+		}
+		for (int s = first; s < end; ++s) {
+			int k = s % arg->ring_size;
+			// the frame before the first of the run belongs to another worker
+			unsigned char *previous = s > first ? rgb_run + (s - first - 1) * rgb_size : NULL;
+			arg->slot_length[k] = encode_frame(&arg->sink, rgb_run + (s - first) * rgb_size, previous,
+			                                   arg->ring + k * arg->slot_size, arg->frame_size);
+			if (arg->slot_length[k] == 0) {
+				fprintf(stderr, "\ncould not encode frame %d\n", s);
+				exit(1);
+			}
+			atomic_write(&arg->slot_done[k], s);
+			post_semaphore(arg->rendered);
+		}
+	}
 
-		// wait until it's out to to write the image
-		while (s != arg->thread_info.back)
-			wait_for_event(arg->event);
-		reset_event(arg->event);
-		fwrite(buf, sizeof(char) * HEIGHT * WIDTH * 3, 1, arg->pipe);
-		++arg->thread_info.back;
-		progress(arg->thread_info.back, arg->thread_info.entry_count, time(NULL) - arg->start);
+	free(rgb_run);
+}
 
-		// notify other threads when we're done
-		set_event(arg->event);
+// the sink may still read from a slot after it has been written, so a run's
+// slots are only given back once its capacity has been written after it
+static void video_writer(void *arg_)
+{
+	struct write_video_arg *arg = (struct write_video_arg *)arg_;
+	int runs = arg->ring_size / VIDEO_RUN;
+	int written_runs = 0, released_runs = 0;
+	long long written = 0;
+
+	for (int n = 0; n < arg->frames; ++n) {
+		int k = n % arg->ring_size;
+		while (atomic_read(&arg->slot_done[k]) != n)
+			wait_for_semaphore(arg->rendered);
+		write_sink(&arg->sink, arg->ring + k * arg->slot_size, arg->slot_length[k]);
+		written += arg->slot_length[k];
+		progress(n + 1, arg->frames, time(NULL) - arg->start);
+		if ((n + 1) % VIDEO_RUN == 0 || n + 1 == arg->frames)
+			arg->run_end[written_runs++ % runs] = written;
+		for (; released_runs < written_runs; ++released_runs) {
+			if (written - arg->run_end[released_runs % runs] < (long long)arg->sink.capacity)
+				break;
+			post_semaphore(arg->run_free);
+		}
 	}
-
-	free(buf);
+	// the workers still need a run each to see there are no more frames
+	for (; released_runs < written_runs; ++released_runs)
+		post_semaphore(arg->run_free);
 }
 
 static void write_video(const char *params, int frames)
 {
 	struct config *config_array = malloc(sizeof(struct config) * frames);
-	set_video_params(params, config_array, frames);
-
-	char *LOSSY_OPTS = "-crf 17 -pix_fmt yuv420p";
-	char *LOSSLESS_OPTS = "-qp 0 -preset veryslow";
-	char buf[256];
-	snprintf(buf, 256,
-	         "ffmpeg -loglevel error -y -f rawvideo -pix_fmt rgb24 -s %dx%d -r %d -i - "
-	         " -c:v libx264 %s %sout.mp4", WIDTH, HEIGHT, FPS, LOSSLESS ? LOSSLESS_OPTS : LOSSY_OPTS, OUT_DIR);
-#ifdef _WIN64
-	char *mode = "wb";
-#else
-	char *mode = "w";
-#endif
-	FILE *pipe = popen(buf, mode);
+	frames = set_video_params(params, config_array, frames);
 
 	struct write_video_arg arg = {0};
-	arg.thread_info.entry_count = frames;
+	arg.sink = (struct video_sink){.type = SINK, .width = WIDTH, .height = HEIGHT, .fps = FPS, .full_chroma = LOSSLESS,
+	                               .quality = MIN(100, MAX(1, JPEG_QUALITY)), .delta = DELTA_FRAMES, .length = frames};
+	ignore_broken_pipe();
+	open_sink(&arg.sink);
+	atomic_write(&arg.thread_info.entry_count, (frames + VIDEO_RUN - 1) / VIDEO_RUN);
 	arg.config_array = config_array;
-	arg.pipe = pipe;
+	arg.frames = frames;
+	arg.lanes = TYPE != AT_TRIG && (long long)WIDTH * HEIGHT * DOWNSCALE * DOWNSCALE <= LANE_PIXELS;
 	arg.start = time(NULL);
-	arg.event = create_event();
+	arg.frame_size = frame_bound(&arg.sink);
+	size_t page = page_size();
+	arg.slot_size = (arg.frame_size + page - 1) / page * page;
+	// a run per worker, one being written and the runs the sink still holds
+	size_t run_size = arg.frame_size * VIDEO_RUN;
+	int runs = MAX(1, THREADS) + 2 + (int)(arg.sink.capacity / run_size);
+	arg.ring_size = runs * VIDEO_RUN;
+	arg.ring = alloc_pages(arg.slot_size * arg.ring_size);
+	arg.slot_length = malloc(sizeof(size_t) * arg.ring_size);
+	arg.run_end = malloc(sizeof(long long) * runs);
+	arg.slot_done = malloc(sizeof(atomic_long) * arg.ring_size);
+	for (int k = 0; k < arg.ring_size; ++k)
+		atomic_write(&arg.slot_done[k], -1);
+	arg.run_free = create_semaphore();
+	for (int k = 0; k < runs; ++k)
+		post_semaphore(arg.run_free);
+	arg.rendered = create_semaphore();
+
+	// the writer blocks on the sink, so it gets a thread outside the pool
+	thread_handle writer = create_thread(video_writer, (thread_arg)&arg);
 	run_jobs(write_video_callback, (void *)&arg);
+	wait_for_multiple_threads(&writer, 1);
+	close_thread(writer);
 	putchar('\n');
+
+	close_semaphore(arg.run_free);
+	close_semaphore(arg.rendered);
+	free(arg.run_end);
+	free(arg.slot_done);
+	free(arg.slot_length);
 	printf("rendered in %lld seconds\n", (long long)(time(NULL) - arg.start));
 
-	pclose(pipe);
-	printf("wrote %sout.mp4", OUT_DIR);
+	// the ring is only free once the sink has read all of it
+	close_sink(&arg.sink);
+	free_pages(arg.ring, arg.slot_size * arg.ring_size);
 
 	// write a thumbnail
 	struct config conf;
-	set_config(&conf, params);
+	set_config(&conf, NULL, params);
 	char name[256];
 	snprintf(name, 256, "%sthumbnail.png", OUT_DIR);
 	write_attractor(name, &conf);
@@ -755,6 +906,63 @@ static void write_video(const char *params, int frames)
 	free(config_array);
 }
 
+struct probe_arg {
+	coef *c;
+	bool *valid;
+};
+
+static void probe_body(void *arg_, int s)
+{
+	struct probe_arg *arg = (struct probe_arg *)arg_;
+	arg->valid[s] = is_valid(TYPE, arg->c[s]);
+}
+
+#define MAX_PROBES 64
+
+// search outwards from the config for the first invalid multiple of step,
+// doubling the distance until a probe fails and then narrowing the bracket
+struct bracket {
+	int dir;
+	long lo, hi;	// lo is valid, hi is invalid or 0 while still doubling
+	long stride;
+	long probe[MAX_PROBES];
+	int probes;
+};
+
+static void bracket_probes(struct bracket *b, int count)
+{
+	b->probes = 0;
+	if (b->hi == 0) {
+		// each round covers count strides past lo, then the stride doubles
+		b->stride = b->stride ? b->stride * 2 : 1;
+		for (int m = 1; m <= count; ++m)
+			b->probe[b->probes++] = b->lo + m * b->stride;
+	} else {
+		// split (lo, hi) into count + 1 parts
+		for (int m = 1; m <= count; ++m) {
+			long k = b->lo + (b->hi - b->lo) * m / (count + 1);
+			if (k > b->lo && k < b->hi && (b->probes == 0 || k > b->probe[b->probes - 1]))
+				b->probe[b->probes++] = k;
+		}
+	}
+}
+
+static void bracket_update(struct bracket *b, bool *valid)
+{
+	for (int m = 0; m < b->probes; ++m) {
+		if (!valid[m]) {
+			b->hi = b->probe[m];
+			return;
+		}
+		b->lo = b->probe[m];
+	}
+}
+
+static bool bracket_done(struct bracket *b)
+{
+	return b->hi != 0 && b->hi == b->lo + 1;
+}
+
 static void video_params(coef c)
 {
 	puts("finding video parameters");
@@ -766,30 +974,51 @@ static void video_params(coef c)
 	}
 
 	static const double step = 1e-2;
-	double tmp = c[CJ][CI];
-	if (!is_set(OP_START)) {
+	struct bracket brackets[2] = {{.dir = -1}, {.dir = 1}};
+	bool search[2] = {!is_set(OP_START), !is_set(OP_END)};
+
+	// probe both directions in the same batch so every thread has work
+	int per_direction = MIN(MAX_PROBES, MAX(1, THREADS / MAX(1, search[0] + search[1])));
+	coef *probe_c = malloc(sizeof(coef) * MAX_PROBES * 2);
+	bool valid[MAX_PROBES * 2];
+	while ((search[0] && !bracket_done(&brackets[0])) || (search[1] && !bracket_done(&brackets[1]))) {
+		struct probe_arg arg = {probe_c, valid};
+		int count = 0;
+		int offset[2];
+		for (int d = 0; d < 2; ++d) {
+			struct bracket *b = &brackets[d];
+			offset[d] = count;
+			if (!search[d] || bracket_done(b)) {
+				b->probes = 0;
+				continue;
+			}
+			bracket_probes(b, per_direction);
+			for (int m = 0; m < b->probes; ++m) {
+				memcpy(probe_c[offset[d] + m], c, sizeof(coef));
+				probe_c[offset[d] + m][CJ][CI] += b->dir * b->probe[m] * step;
+			}
+			count += b->probes;
+		}
+		pool_for(count, 1, probe_body, (void *)&arg);
+		for (int d = 0; d < 2; ++d)
+			bracket_update(&brackets[d], valid + offset[d]);
+	}
+	free(probe_c);
+
+	// stop at the last valid probe, the first invalid one would always be a
+	// frame that isn't chaotic
+	if (search[0]) {
 		set(OP_START);
-		double dt = 0;
-		do {
-			dt += step;
-			c[CJ][CI] = tmp - dt;
-		} while (is_valid(c));
-		START = -dt;
-		c[CJ][CI] = tmp;
-	}
-	if (!is_set(OP_END)) {
+		START = -brackets[0].lo * step;
+	}
+	if (search[1]) {
 		set(OP_END);
-		double dt = 0;
-		do {
-			dt += step;
-			c[CJ][CI] = tmp + dt;
-		} while (is_valid(c));
-		END = dt;
-		c[CJ][CI] = tmp;
+		END = brackets[1].lo * step;
 	}
 }
 
-static void load_config(struct config config_array[256], int *count)
+// read the first count configs of the params file
+static void load_config(struct config *config_array, int count)
 {
 	FILE *f = fopen(PARAMS, "r");
 	if (f == NULL) {
@@ -797,36 +1026,403 @@ static void load_config(struct config config_array[256], int *count)
 		exit(1);
 	}
 
-	if (*count == 0)  {
-		while (!feof(f))
-			*count += fgetc(f) == '\n';
-		rewind(f);
+	char buf[PARAMS_LEN];
+	for (int i = 0; i < count && fgets(buf, PARAMS_LEN, f); ++i) {
+		if (!set_config(&config_array[i], NULL, buf))
+			params_error(i, buf);
+		// frames are interpolated between configs of the same type
+		if (config_array[i].type != TYPE) {
+			fprintf(stderr, "\"%s\" has %s attractors, run with -type %s\n", PARAMS,
+			        attractor_map[config_array[i].type], attractor_map[config_array[i].type]);
+			exit(1);
+		}
 	}
+	fclose(f);
+}
 
-	char buf[256];
-	for (int i = 0; i < *count && fgets(buf, 256, f); ++i) {
-		int result = set_config(&config_array[i], buf);
-		if (!result) {
-			fprintf(stderr, "parse error when reading \"%s\", line %d:\n", PARAMS, i);
-			fprintf(stderr, "%s", buf);
-			fprintf(stderr, "%s should be a %s\n", PARAMS, options[OP_PARAMS].doc);
-			exit(1);
+enum scan_status {
+	SCAN_CHAOTIC,
+	SCAN_DIVERGED,
+	SCAN_CONVERGED,
+	SCAN_PERIODIC,
+	SCAN_REGULAR,
+};
+
+// same test as attractor_validate() for LANES sets of coefficients at once
+static void attractor_lanes(coef_lanes c, double lyapunov[LANES], unsigned char status[LANES])
+{
+	vec_lanes x = {0}, xe = {0}, x_cycle = {0};
+	for (int l = 0; l < LANES; ++l) {
+		xe[0][l] = 1e-3;
+		lyapunov[l] = 0;
+		status[l] = SCAN_CHAOTIC;
+	}
+	double d0 = 1e-3;
+	unsigned power = 1, lambda = 0;
+
+	for (unsigned n = 0; n < CUTOFF * 2; ++n) {
+		iteration_lanes(TYPE, c, x, LANES);
+		iteration_lanes(TYPE, c, xe, LANES);
+
+		int alive = 0;
+		for (int l = 0; l < LANES; ++l) {
+			double a0 = fabs(x[0][l]), a1 = fabs(x[1][l]);
+			double d0c = x[0][l] - x_cycle[0][l], d1c = x[1][l] - x_cycle[1][l];
+			double m = sqrt(x[0][l] * x[0][l] + x[1][l] * x[1][l]);
+			unsigned char s =
+				!(a0 <= 1e10 && a1 <= 1e10) ? SCAN_DIVERGED :
+				a0 < 1e-10 || a1 < 1e-10 ? SCAN_CONVERGED :
+				sqrt(d0c * d0c + d1c * d1c) < CYCLE_EPSILON * (1 + m) ? SCAN_PERIODIC :
+				SCAN_CHAOTIC;
+			status[l] = status[l] == SCAN_CHAOTIC ? s : status[l];
+			alive += status[l] == SCAN_CHAOTIC;
 		}
+		if (!alive)
+			return;
+
+		if (++lambda == power) {
+			memcpy(x_cycle, x, sizeof(vec_lanes));
+			power *= 2;
+			lambda = 0;
+		}
+
+		if (n > CUTOFF)
+			for (int l = 0; l < LANES; ++l) {
+				double d0x = xe[0][l] - x[0][l], d1x = xe[1][l] - x[1][l];
+				lyapunov[l] += log(sqrt(d0x * d0x + d1x * d1x) / d0);
+			}
+	}
+
+	for (int l = 0; l < LANES; ++l) {
+		lyapunov[l] /= CUTOFF;
+		if (status[l] == SCAN_CHAOTIC && !(lyapunov[l] > 5))
+			status[l] = SCAN_REGULAR;
 	}
 }
 
-int main(int argc, char **argv)
+struct scan_arg {
+	struct work_queue_info thread_info;
+	struct config *conf;
+	int ci[2], cj[2];
+	float *lyapunov;
+	unsigned char *status;
+	time_t start;
+};
+
+static double scan_value(struct scan_arg *arg, int axis, int k)
+{
+	double t = RESOLUTION > 1 ? (double)k / (RESOLUTION - 1) * 2 - 1 : 0;
+	return arg->conf->c[arg->cj[axis]][arg->ci[axis]] + t * RANGE;
+}
+
+static void scan_callback(void *arg_)
 {
-	for (int g = 0; g < NUM_GRADIENTS; ++g)
-		for (int i = 0; i < GN; ++i) {
-			double tmp[3];
-			for (int k = 0; k < 3; ++k)
-				tmp[k] = gradients[g][i][k] / 0xff;
-			set_brightness((double)i / (GN - 1), tmp, tmp);
-			for (int k = 0; k < 3; ++k)
-				gradients[g][i][k] = tmp[k] * 0xff;
+	struct scan_arg *arg = (struct scan_arg *)arg_;
+
+	for (;;) {
+		int row = interlocked_increment(&arg->thread_info.next_entry) - 1;
+		if (row >= atomic_read(&arg->thread_info.entry_count))
+			break;
+
+		for (int col = 0; col < RESOLUTION; col += LANES) {
+			coef_lanes c;
+			for (int l = 0; l < LANES; ++l)
+				for (int i = 0; i < 2; ++i)
+					for (int j = 0; j < 8; ++j)
+						c[j][i][l] = arg->conf->c[j][i];
+			for (int l = 0; l < LANES; ++l) {
+				c[arg->cj[0]][arg->ci[0]][l] = scan_value(arg, 0, MIN(col + l, RESOLUTION - 1));
+				c[arg->cj[1]][arg->ci[1]][l] = scan_value(arg, 1, row);
+			}
+
+			double lyapunov[LANES];
+			unsigned char status[LANES];
+			attractor_lanes(c, lyapunov, status);
+			for (int l = 0; l < LANES && col + l < RESOLUTION; ++l) {
+				// the first coefficient increases to the right, the second upwards
+				int s = (RESOLUTION - 1 - row) * RESOLUTION + col + l;
+				arg->lyapunov[s] = (float)lyapunov[l];
+				arg->status[s] = status[l];
+			}
+		}
+
+		int b = interlocked_increment(&arg->thread_info.back);
+		progress(b, atomic_read(&arg->thread_info.entry_count), time(NULL) - arg->start);
+	}
+}
+
+static void parse_scan_coefficients(int ci[2], int cj[2])
+{
+	if (!SCAN_COEFFICIENTS) {
+		ci[0] = rand() % 2, cj[0] = rand() % CN;
+		do
+			ci[1] = rand() % 2, cj[1] = rand() % CN;
+		while (ci[1] == ci[0] && cj[1] == cj[0]);
+		return;
+	}
+
+	char c[2];
+	int result = sscanf(SCAN_COEFFICIENTS, "%c%d,%c%d", &c[0], &cj[0], &c[1], &cj[1]);
+	for (int k = 0; k < 2; ++k) {
+		if (result < 4 || (c[k] != 'x' && c[k] != 'y') || cj[k] < 0 || cj[k] >= CN)
+			option_error("-coefficients", "regex [xy]\\d,[xy]\\d", SCAN_COEFFICIENTS);
+		ci[k] = c[k] == 'x' ? 0 : 1;
+	}
+	// the row's value would overwrite the column's
+	if (ci[0] == ci[1] && cj[0] == cj[1])
+		option_error("-coefficients", "two different coefficients", SCAN_COEFFICIENTS);
+}
+
+struct scan_header {
+	unsigned magic;
+	int resolution;
+	int type;
+	int ci[2], cj[2];
+	double centre[2];
+	double range;
+};
+
+static void write_scan(struct config *conf)
+{
+	struct scan_arg arg = {0};
+	parse_scan_coefficients(arg.ci, arg.cj);
+	int cells = RESOLUTION * RESOLUTION;
+	arg.conf = conf;
+	arg.lyapunov = malloc(sizeof(float) * cells);
+	arg.status = malloc(sizeof(char) * cells);
+	atomic_write(&arg.thread_info.entry_count, RESOLUTION);
+	arg.start = time(NULL);
+	printf("scanning %c%d against %c%d\n", "xy"[arg.ci[0]], arg.cj[0], "xy"[arg.ci[1]], arg.cj[1]);
+	run_jobs(scan_callback, (void *)&arg);
+	putchar('\n');
+
+	// colour chaotic cells by their lyapunov exponent
+	float lo = FLT_MAX, hi = -FLT_MAX;
+	for (int s = 0; s < cells; ++s)
+		if (arg.status[s] == SCAN_CHAOTIC) {
+			lo = MIN(lo, arg.lyapunov[s]);
+			hi = MAX(hi, arg.lyapunov[s]);
+		}
+	unsigned char *buf = malloc(sizeof(char) * cells * 3);
+	for (int s = 0; s < cells; ++s) {
+		unsigned char *rgb = &buf[s * 3];
+		switch (arg.status[s]) {
+			case SCAN_CHAOTIC:
+			{
+				double g = hi > lo ? (arg.lyapunov[s] - lo) / (hi - lo) * (GN - 1) : GN - 1;
+				int l = (int)floor(g), r = (int)ceil(g);
+				double tmp[3];
+				lerp(tmp, context->gradients[INFERNO][l], context->gradients[INFERNO][r], fmod(g, 1));
+				for (int k = 0; k < 3; ++k)
+					rgb[k] = (unsigned char)tmp[k];
+				break;
+			}
+			case SCAN_REGULAR:
+				rgb[0] = rgb[1] = 0x20, rgb[2] = 0x40;
+				break;
+			case SCAN_PERIODIC:
+			case SCAN_CONVERGED:
+				rgb[0] = rgb[1] = rgb[2] = 0x20;
+				break;
+			default:
+				rgb[0] = rgb[1] = rgb[2] = 0;
+				break;
 		}
+	}
+
+	char name[256];
+	snprintf(name, 256, "%sscan.png", OUT_DIR);
+	write_image(name, RESOLUTION, RESOLUTION, buf);
+
+	// raw grid, header followed by the lyapunov exponents then the statuses,
+	// both in row major order with the first row at the top of the image
+	struct scan_header header = {0};
+	header.magic = 0x4e435341; // "ASCN"
+	header.resolution = RESOLUTION;
+	header.type = TYPE;
+	for (int k = 0; k < 2; ++k) {
+		header.ci[k] = arg.ci[k];
+		header.cj[k] = arg.cj[k];
+		header.centre[k] = conf->c[arg.cj[k]][arg.ci[k]];
+	}
+	header.range = RANGE;
+	snprintf(name, 256, "%sscan.bin", OUT_DIR);
+	FILE *f = fopen(name, "wb");
+	if (f == NULL) {
+		printf("failed to write %s\n", name);
+	} else {
+		fwrite(&header, sizeof(header), 1, f);
+		fwrite(arg.lyapunov, sizeof(float), cells, f);
+		fwrite(arg.status, sizeof(char), cells, f);
+		fclose(f);
+		printf("wrote %s\n", name);
+	}
+
+	char params[PARAMS_LEN];
+	attractor_format(conf, params);
+	printf("centre %s\n", params);
+
+	free(buf);
+	free(arg.status);
+	free(arg.lyapunov);
+}
 
+#define FP 16
+#define FINGERPRINT_ITERATIONS (FP * FP * 128)
+
+// density of the attractor on a coarse grid over its bounds, so rescaled
+// coefficients giving the same shape get the same fingerprint
+struct fingerprint {
+	float density[FP][FP];
+	float radial[FP / 2];	// density summed over rings around the centre
+};
+
+static void fingerprint(struct config *conf, struct fingerprint *fp)
+{
+	memset(fp, 0, sizeof(struct fingerprint));
+	vec x = {0};
+	start_orbit(conf, x);
+
+	for (unsigned n = 0; n < FINGERPRINT_ITERATIONS; ++n) {
+		iteration(conf->type, conf->c, x);
+		int b[2];
+		for (int i = 0; i < 2; ++i) {
+			double t = (x[i] - conf->x_min[i]) / (conf->x_max[i] - conf->x_min[i]);
+			b[i] = MIN(FP - 1, MAX(0, (int)(t * FP)));
+		}
+		fp->density[b[0]][b[1]] += 1.0f / FINGERPRINT_ITERATIONS;
+	}
+
+	for (int i = 0; i < FP; ++i)
+		for (int j = 0; j < FP; ++j) {
+			int r = MAX(abs(2 * i + 1 - FP), abs(2 * j + 1 - FP)) / 2;
+			fp->radial[r] += fp->density[i][j];
+		}
+}
+
+// one of the 8 rotations and mirrors of the square grid
+static float transformed(struct fingerprint *fp, int t, int i, int j)
+{
+	int n = FP - 1;
+	switch (t) {
+		case 0: return fp->density[i][j];
+		case 1: return fp->density[j][i];
+		case 2: return fp->density[n - i][j];
+		case 3: return fp->density[i][n - j];
+		case 4: return fp->density[n - i][n - j];
+		case 5: return fp->density[j][n - i];
+		case 6: return fp->density[n - j][i];
+		default: return fp->density[n - j][n - i];
+	}
+}
+
+// l1 distance between fingerprints under the closest rotation or mirror
+static float fingerprint_distance(struct fingerprint *a, struct fingerprint *b, float limit)
+{
+	// the rings are unchanged by rotations and mirrors, so their distance is
+	// a lower bound which rules out most pairs cheaply
+	float radial = 0;
+	for (int r = 0; r < FP / 2; ++r)
+		radial += fabsf(a->radial[r] - b->radial[r]);
+	if (radial >= limit)
+		return radial;
+
+	float best = FLT_MAX;
+	for (int t = 0; t < 8; ++t) {
+		float d = 0;
+		for (int i = 0; i < FP && d < best; ++i)
+			for (int j = 0; j < FP; ++j)
+				d += fabsf(a->density[i][j] - transformed(b, t, i, j));
+		best = MIN(best, d);
+	}
+	return best;
+}
+
+struct gallery_arg {
+	mutex_handle lock;
+	struct fingerprint *index;
+	int index_len, index_size;
+	int written, duplicates;
+	FILE *txt;
+	time_t start;
+};
+
+static bool gallery_done(struct gallery_arg *arg)
+{
+	return arg->index_len >= COUNT || (TIME_LIMIT && time(NULL) - arg->start >= TIME_LIMIT);
+}
+
+static void gallery_callback(void *arg_)
+{
+	struct gallery_arg *arg = (struct gallery_arg *)arg_;
+	unsigned char *buf = malloc(sizeof(char) * HEIGHT * WIDTH * 3);
+
+	for (;;) {
+		lock_mutex(arg->lock);
+		bool done = gallery_done(arg);
+		unlock_mutex(arg->lock);
+		if (done)
+			break;
+
+		struct config conf;
+		struct fingerprint fp;
+		random_config(&conf);
+		fingerprint(&conf, &fp);
+
+		lock_mutex(arg->lock);
+		bool duplicate = false;
+		for (int k = 0; k < arg->index_len && !duplicate; ++k)
+			duplicate = fingerprint_distance(&fp, &arg->index[k], (float)SIMILARITY) < SIMILARITY;
+		if (duplicate || gallery_done(arg)) {
+			arg->duplicates += duplicate;
+			unlock_mutex(arg->lock);
+			continue;
+		}
+		if (arg->index_len == arg->index_size) {
+			arg->index_size = MAX(64, arg->index_size * 2);
+			arg->index = realloc(arg->index, sizeof(struct fingerprint) * arg->index_size);
+		}
+		int s = arg->index_len++;
+		memcpy(&arg->index[s], &fp, sizeof(struct fingerprint));
+		char params[PARAMS_LEN];
+		attractor_format(&conf, params);
+		fprintf(arg->txt, "%s # %d\n", params, s);
+		fflush(arg->txt);
+		unlock_mutex(arg->lock);
+
+		char name[256];
+		snprintf(name, 256, "%sgallery_%d.png", OUT_DIR, s);
+		attractor_render(context, &settings, &conf, buf);
+		write_image(name, WIDTH, HEIGHT, buf);
+	}
+
+	free(buf);
+}
+
+// search continuously, writing every attractor that doesn't look like one
+// already written until -count or -time-limit is reached
+static void write_gallery(void)
+{
+	struct gallery_arg arg = {0};
+	arg.start = time(NULL);
+	char name[256];
+	snprintf(name, 256, "%sgallery.txt", OUT_DIR);
+	arg.txt = fopen(name, "w");
+	if (arg.txt == NULL) {
+		printf("failed to write %s\n", name);
+		return;
+	}
+	arg.lock = create_mutex();
+	run_jobs(gallery_callback, (void *)&arg);
+	close_mutex(arg.lock);
+	fclose(arg.txt);
+	printf("wrote %d attractors, dropped %d duplicates\n", arg.index_len, arg.duplicates);
+	free(arg.index);
+}
+
+int main(int argc, char **argv)
+{
+	context = attractor_create();
 	srand((unsigned int)time(NULL));
 
 	// print help if no args
@@ -847,8 +1443,12 @@ int main(int argc, char **argv)
 		mode = VIDEO;
 	else if (0 == strcmp("image", argv[1]))
 		mode = IMAGE;
+	else if (0 == strcmp("scan", argv[1]))
+		mode = SCAN;
+	else if (0 == strcmp("gallery", argv[1]))
+		mode = GALLERY;
 	else {
-		fprintf(stderr, "unknown mode: %s, expected \"image\" or \"video\"\n", argv[1]);
+		fprintf(stderr, "unknown mode: %s, expected \"image\", \"video\", \"scan\" or \"gallery\"\n", argv[1]);
 		exit(1);
 	}
 
@@ -856,7 +1456,32 @@ int main(int argc, char **argv)
 	assert(argc % 2 == 0);
 	for (int i = 2; i < argc; i += 2)
 		parse_option(mode, argv[i], argv[i + 1]);
-	ITERATIONS = WIDTH * HEIGHT * (unsigned long long)QUALITY;
+	settings = (struct render_settings){
+		.width = WIDTH, .height = HEIGHT,
+		.downscale = DOWNSCALE,
+		.quality = QUALITY,
+		.intensity = INTENSITY,
+		.border = BORDER,
+		.light = LIGHT,
+		.stretch = STRETCH,
+	};
+	pool_start(THREADS);
+
+	if (FROM_DB && !DB) {
+		fprintf(stderr, "option error: -from-db requires -db\n");
+		exit(1);
+	} else if (FROM_DB && PARAMS) {
+		option_conflict_error(OP_FROM_DB, OP_PARAMS);
+	}
+	if (DB && !db_open(&db, DB, TYPE, CN)) {
+		fprintf(stderr, "could not open database \"%s_%s.db\"\n", DB, attractor_map[TYPE]);
+		exit(1);
+	}
+	if (MODEL)
+		load_model();
+	else
+		init_model();
+	search.lock = create_mutex();
 
 	switch (mode) {
 		case IMAGE:
@@ -868,50 +1493,72 @@ int main(int argc, char **argv)
 				if (is_set(OP_COLOUR))
 					option_conflict_error(OP_COLOUR, OP_PREVIEW);
 				struct config config_array[COLOUR_COUNT];
-				int count = 1;
 				if (PARAMS)
-					load_config(config_array, &count);
+					load_config(config_array, 1);
 				else
-					random_config(&config_array[0]), putchar('\n');
+					puts("finding attractor parameters"), random_config(&config_array[0]);
 				for (int i = 1; i < COLOUR_COUNT; ++i) {
 					memcpy(&config_array[i], &config_array[0], sizeof(struct config));
 					config_array[i].colour = (enum colour_type)i;
 				}
 				config_array[0].colour = (enum colour_type)0;
 
-				write_samples("colour_preview", config_array, COLOUR_COUNT);
+				write_samples("colour_preview", config_array, COLOUR_COUNT, false);
 			} else if (PARAMS) {
-				struct config config_array[256];
-				int count = 0;
-				load_config(config_array, &count);
-				write_attractors(config_array, count);
+				write_attractors();
 			} else {
 				struct config conf;
-				random_config(&conf); putchar('\n');
-				char buf[256];
-				str_c(conf.c, buf);
+				puts("finding attractor parameters");
+				random_config(&conf);
 				char name[256];
 				snprintf(name, 256, "%ssingle.png", OUT_DIR);
 				write_attractor(name, &conf);
 			}
 			break;
 		case VIDEO:
+			// the frames go to stdout, so everything else goes to stderr
+			if (OUT && 0 == strcmp(OUT, "-")) {
+				if (SINK == SINK_FFMPEG || SINK == SINK_IMAGES || SINK == SINK_AVI) {
+					fprintf(stderr, "option error: -out - needs -sink Y4M, YUV, RGB or APNG\n");
+					exit(1);
+				}
+				video_stdout = take_stdout();
+			}
 			struct config conf;
-			int count = 1;
 			if (PARAMS)
-				load_config(&conf, &count);
+				load_config(&conf, 1);
 			else
-				random_config(&conf), putchar('\n');
+				puts("finding attractor parameters"), random_config(&conf);
 			video_params(conf.c);
-			char params[256];
-			str_c(conf.c, params);
+			char params[PARAMS_LEN];
+			attractor_format(&conf, params);
 			if (PREVIEW)
 				video_preview(params, PREVIEW);
 			else
 				write_video(params, DURATION * FPS);
 			break;
+		case SCAN:
+		{
+			struct config conf;
+			if (PARAMS)
+				load_config(&conf, 1);
+			else
+				puts("finding attractor parameters"), random_config(&conf);
+			write_scan(&conf);
+		} break;
+		case GALLERY:
+			write_gallery();
+			break;
 	}
 
+	if (DB)
+		db_close(&db);
+	if (MODEL)
+		save_model();
+	print_search_stats();
+	pool_stop();
+	attractor_destroy(context);
+
 	// print the final configuration
 	print_values(mode);
 }
@@ -10,6 +10,7 @@ struct arg_wrapper {
 #ifdef _WIN64 // windows
 
 #define WIN32_LEAN_AND_MEAN
+#include <limits.h>
 #include <windows.h>
 
 typedef HANDLE thread_handle;
@@ -19,15 +20,17 @@ DWORD WINAPI callback_wrapper(void *arg_)
 {
 	struct arg_wrapper *arg = arg_;
 	arg->callback(arg->arg);
+	free(arg_);
 	return 0;
 }
 
+// the wrapper is read by the new thread, so it can't live on this stack
 thread_handle create_thread(thread_callback *callback, thread_arg arg)
 {
-	struct arg_wrapper arg_ = {0};
-	arg_.callback = callback;
-	arg_.arg = arg;
-	return CreateThread(0, 0, callback_wrapper, &arg_, 0, 0);
+	struct arg_wrapper *arg_ = malloc(sizeof(struct arg_wrapper));
+	arg_->callback = callback;
+	arg_->arg = arg;
+	return CreateThread(0, 0, callback_wrapper, arg_, 0, 0);
 }
 
 void wait_for_multiple_threads(thread_handle handles[], int count)
@@ -40,11 +43,37 @@ void close_thread(thread_handle handle)
 	CloseHandle(handle);
 }
 
-long interlocked_increment(long *i)
+void yield_thread(void)
+{
+	SwitchToThread();
+}
+
+// msvc's c11 atomics are still experimental, the interlocked functions are
+// full barriers
+typedef volatile long atomic_long;
+
+long interlocked_increment(atomic_long *i)
 {
 	return InterlockedIncrement(i);
 }
 
+long interlocked_decrement(atomic_long *i)
+{
+	return InterlockedDecrement(i);
+}
+
+long atomic_read(atomic_long *i)
+{
+	return InterlockedCompareExchange(i, 0, 0);
+}
+
+void atomic_write(atomic_long *i, long value)
+{
+	InterlockedExchange(i, value);
+}
+
+#define THREAD_LOCAL __declspec(thread)
+
 event_handle create_event(void)
 {
 	return CreateEvent(NULL,  // default security attributes
@@ -68,8 +97,144 @@ void wait_for_event(event_handle handle)
 	WaitForSingleObject(handle, INFINITE);
 }
 
-#define popen _popen
-#define pclose _pclose
+void close_event(event_handle handle)
+{
+	CloseHandle(handle);
+}
+
+typedef HANDLE semaphore_handle;
+
+semaphore_handle create_semaphore(void)
+{
+	return CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+}
+
+void post_semaphore(semaphore_handle handle)
+{
+	ReleaseSemaphore(handle, 1, NULL);
+}
+
+void wait_for_semaphore(semaphore_handle handle)
+{
+	WaitForSingleObject(handle, INFINITE);
+}
+
+void close_semaphore(semaphore_handle handle)
+{
+	CloseHandle(handle);
+}
+
+typedef CRITICAL_SECTION *mutex_handle;
+
+mutex_handle create_mutex(void)
+{
+	mutex_handle handle = malloc(sizeof(CRITICAL_SECTION));
+	InitializeCriticalSection(handle);
+	return handle;
+}
+
+void lock_mutex(mutex_handle handle)
+{
+	EnterCriticalSection(handle);
+}
+
+void unlock_mutex(mutex_handle handle)
+{
+	LeaveCriticalSection(handle);
+}
+
+void close_mutex(mutex_handle handle)
+{
+	DeleteCriticalSection(handle);
+	free(handle);
+}
+
+// seconds of cpu time used by the calling thread
+double thread_cpu_time(void)
+{
+	FILETIME creation, exit, kernel, user;
+	GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+	ULARGE_INTEGER k = {.LowPart = kernel.dwLowDateTime, .HighPart = kernel.dwHighDateTime};
+	ULARGE_INTEGER u = {.LowPart = user.dwLowDateTime, .HighPart = user.dwHighDateTime};
+	return (double)(k.QuadPart + u.QuadPart) * 1e-7;
+}
+
+// seconds since some fixed point, for measuring intervals
+double wall_time(void)
+{
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return (double)count.QuadPart / frequency.QuadPart;
+}
+
+// a child process reading its stdin from a pipe
+struct process_pipe {
+	FILE *file;
+	size_t capacity;	// writes copy the data, so none is held after a write
+};
+
+bool open_process_pipe(struct process_pipe *p, char *argv[])
+{
+	char command[1024];
+	int c = 0;
+	for (int i = 0; argv[i]; ++i) {
+		c += snprintf(command + c, sizeof(command) - c, i ? " \"%s\"" : "%s", argv[i]);
+		// a cut off command would run with the wrong arguments
+		if (c >= (int)sizeof(command))
+			return false;
+	}
+	p->file = _popen(command, "wb");
+	p->capacity = 0;
+	return p->file != NULL;
+}
+
+bool write_process_pipe(struct process_pipe *p, const void *data, size_t size)
+{
+	return fwrite(data, size, 1, p->file) == 1;
+}
+
+// returns the exit code of the process
+int close_process_pipe(struct process_pipe *p)
+{
+	return _pclose(p->file);
+}
+
+size_t page_size(void)
+{
+	SYSTEM_INFO sysinfo;
+	GetSystemInfo(&sysinfo);
+	return sysinfo.dwPageSize;
+}
+
+void *alloc_pages(size_t size)
+{
+	return VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
+void free_pages(void *data, size_t size)
+{
+	VirtualFree(data, 0, MEM_RELEASE);
+}
+
+#include <fcntl.h>
+#include <io.h>
+
+// there is no SIGPIPE, a write to a closed pipe just fails
+void ignore_broken_pipe(void)
+{
+}
+
+// a binary stream on what was stdout, stdout itself then goes to stderr so
+// messages don't end up in the data written to the stream
+FILE *take_stdout(void)
+{
+	fflush(stdout);
+	int fd = _dup(_fileno(stdout));
+	_dup2(_fileno(stderr), _fileno(stdout));
+	_setmode(fd, _O_BINARY);
+	return _fdopen(fd, "wb");
+}
 
 int platform_thread_count(void)
 {
@@ -78,6 +243,81 @@ int platform_thread_count(void)
 	return sysinfo.dwNumberOfProcessors;
 }
 
+struct mapped_file {
+	void *data;
+	size_t size;
+	HANDLE file;
+	HANDLE mapping;
+};
+
+// map a file read/write, creating it or growing it to at least size bytes
+bool map_file(struct mapped_file *m, const char *name, size_t size)
+{
+	m->file = CreateFileA(name, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+	                      NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m->file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(m->file, &file_size);
+	m->size = MAX((size_t)file_size.QuadPart, size);
+	m->mapping = CreateFileMappingA(m->file, NULL, PAGE_READWRITE,
+	                                (DWORD)((unsigned long long)m->size >> 32), (DWORD)m->size, NULL);
+	if (m->mapping == NULL) {
+		CloseHandle(m->file);
+		return false;
+	}
+	m->data = MapViewOfFile(m->mapping, FILE_MAP_ALL_ACCESS, 0, 0, m->size);
+	if (m->data == NULL) {
+		CloseHandle(m->mapping);
+		CloseHandle(m->file);
+		return false;
+	}
+	return true;
+}
+
+// map an existing file read only, an empty file maps to no data
+bool map_file_readonly(struct mapped_file *m, const char *name)
+{
+	m->data = NULL;
+	m->mapping = NULL;
+	m->file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+	                      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m->file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(m->file, &file_size);
+	m->size = (size_t)file_size.QuadPart;
+	if (m->size == 0)
+		return true;
+	m->mapping = CreateFileMappingA(m->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m->mapping == NULL) {
+		CloseHandle(m->file);
+		return false;
+	}
+	m->data = MapViewOfFile(m->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (m->data == NULL) {
+		CloseHandle(m->mapping);
+		CloseHandle(m->file);
+		return false;
+	}
+	return true;
+}
+
+// let the os drop pages of a read only mapping that won't be needed again
+void release_mapped(struct mapped_file *m, size_t offset, size_t size)
+{
+	// windows trims the working set by itself
+}
+
+void unmap_file(struct mapped_file *m)
+{
+	if (m->data)
+		UnmapViewOfFile(m->data);
+	if (m->mapping)
+		CloseHandle(m->mapping);
+	CloseHandle(m->file);
+}
+
 #else // linux
 
 #include <pthread.h>
@@ -113,58 +353,344 @@ void close_thread(thread_handle handle)
 	// should be done autmoatically
 }
 
-long interlocked_increment(long *i)
+#include <sched.h>
+
+void yield_thread(void)
 {
-	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-	pthread_mutex_lock(&lock);
-	long result = ++*i;
-	pthread_mutex_unlock(&lock);
-	return result;
+	sched_yield();
 }
 
+#include <stdatomic.h>
+
+long interlocked_increment(atomic_long *i)
+{
+	return atomic_fetch_add(i, 1) + 1;
+}
+
+long interlocked_decrement(atomic_long *i)
+{
+	return atomic_fetch_sub(i, 1) - 1;
+}
+
+long atomic_read(atomic_long *i)
+{
+	return atomic_load_explicit(i, memory_order_acquire);
+}
+
+void atomic_write(atomic_long *i, long value)
+{
+	atomic_store_explicit(i, value, memory_order_release);
+}
+
+#define THREAD_LOCAL _Thread_local
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// manual reset event on a futex, waking only costs a syscall when a thread
+// is asleep on it
 struct event_handle_base {
-	bool triggered;
-	pthread_mutex_t lock;
-	pthread_cond_t cond;
+	atomic_int state;	// 1 while set
+	atomic_int waiters;
 };
 typedef struct event_handle_base *event_handle;
 
 event_handle create_event(void)
 {
 	event_handle handle = malloc(sizeof(struct event_handle_base));
-	pthread_mutex_init(&handle->lock, NULL);
-	pthread_cond_init(&handle->cond, NULL);
-	handle->triggered = false;
+	atomic_init(&handle->state, 0);
+	atomic_init(&handle->waiters, 0);
 	return handle;
 }
 
 void set_event(event_handle handle)
 {
-	pthread_mutex_lock(&handle->lock);
-	handle->triggered = true;
-	pthread_cond_broadcast(&handle->cond);
-	pthread_mutex_unlock(&handle->lock);
+	atomic_store(&handle->state, 1);
+	if (atomic_load(&handle->waiters) > 0)
+		syscall(SYS_futex, &handle->state, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
 }
 
 void reset_event(event_handle handle)
 {
-	pthread_mutex_lock(&handle->lock);
-	handle->triggered = false;
-	pthread_mutex_unlock(&handle->lock);
+	atomic_store(&handle->state, 0);
 }
 
+// the kernel only sleeps if state is still 0, so a set between the check
+// and the syscall isn't missed
 void wait_for_event(event_handle handle)
 {
-	pthread_mutex_lock(&handle->lock);
-	while (!handle->triggered)
-		pthread_cond_wait(&handle->cond, &handle->lock);
-	pthread_mutex_unlock(&handle->lock);
+	while (atomic_load(&handle->state) == 0) {
+		atomic_fetch_add(&handle->waiters, 1);
+		syscall(SYS_futex, &handle->state, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+		atomic_fetch_sub(&handle->waiters, 1);
+	}
+}
+
+void close_event(event_handle handle)
+{
+	free(handle);
+}
+
+#include <semaphore.h>
+
+// wakes one waiter per post, unlike an event
+typedef sem_t *semaphore_handle;
+
+semaphore_handle create_semaphore(void)
+{
+	semaphore_handle handle = malloc(sizeof(sem_t));
+	sem_init(handle, 0, 0);
+	return handle;
+}
+
+void post_semaphore(semaphore_handle handle)
+{
+	sem_post(handle);
+}
+
+void wait_for_semaphore(semaphore_handle handle)
+{
+	while (sem_wait(handle) != 0)
+		;
+}
+
+void close_semaphore(semaphore_handle handle)
+{
+	sem_destroy(handle);
+	free(handle);
+}
+
+typedef pthread_mutex_t *mutex_handle;
+
+mutex_handle create_mutex(void)
+{
+	mutex_handle handle = malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init(handle, NULL);
+	return handle;
+}
+
+void lock_mutex(mutex_handle handle)
+{
+	pthread_mutex_lock(handle);
+}
+
+void unlock_mutex(mutex_handle handle)
+{
+	pthread_mutex_unlock(handle);
+}
+
+void close_mutex(mutex_handle handle)
+{
+	pthread_mutex_destroy(handle);
+	free(handle);
+}
+
+#include <time.h>
+
+// seconds of cpu time used by the calling thread
+double thread_cpu_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// seconds since some fixed point, for measuring intervals
+double wall_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
 }
 
-#include <unistd.h>
 int platform_thread_count(void)
 {
 	return (int)sysconf(_SC_NPROCESSORS_ONLN);
 }
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct mapped_file {
+	void *data;
+	size_t size;
+	int fd;
+};
+
+// map a file read/write, creating it or growing it to at least size bytes
+bool map_file(struct mapped_file *m, const char *name, size_t size)
+{
+	m->fd = open(name, O_RDWR | O_CREAT, 0644);
+	if (m->fd < 0)
+		return false;
+	struct stat st;
+	fstat(m->fd, &st);
+	m->size = MAX((size_t)st.st_size, size);
+	if ((size_t)st.st_size < m->size && ftruncate(m->fd, (off_t)m->size) != 0) {
+		close(m->fd);
+		return false;
+	}
+	m->data = mmap(NULL, m->size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+	if (m->data == MAP_FAILED) {
+		close(m->fd);
+		return false;
+	}
+	return true;
+}
+
+// map an existing file read only, an empty file maps to no data
+bool map_file_readonly(struct mapped_file *m, const char *name)
+{
+	m->data = NULL;
+	m->fd = open(name, O_RDONLY);
+	if (m->fd < 0)
+		return false;
+	struct stat st;
+	fstat(m->fd, &st);
+	m->size = (size_t)st.st_size;
+	if (m->size == 0)
+		return true;
+	m->data = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, m->fd, 0);
+	if (m->data == MAP_FAILED) {
+		close(m->fd);
+		return false;
+	}
+	madvise(m->data, m->size, MADV_SEQUENTIAL);
+	return true;
+}
+
+// let the os drop pages of a read only mapping that won't be needed again
+void release_mapped(struct mapped_file *m, size_t offset, size_t size)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t begin = (offset + page - 1) / page * page;
+	size_t end = (offset + size) / page * page;
+	if (begin < end)
+		madvise((char *)m->data + begin, end - begin, MADV_DONTNEED);
+}
+
+void unmap_file(struct mapped_file *m)
+{
+	if (m->data)
+		munmap(m->data, m->size);
+	close(m->fd);
+}
+
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+#define PROCESS_PIPE_SIZE (1 << 20)
+
+// a child process reading its stdin from a pipe. pages are handed to the pipe
+// with vmsplice instead of being copied, so written data may still be read
+// from its pages until capacity more bytes have been written after it
+struct process_pipe {
+	int fd;
+	pid_t pid;
+	size_t capacity;
+};
+
+// argv[0] is looked up in PATH and started without a shell
+bool open_process_pipe(struct process_pipe *p, char *argv[])
+{
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) != 0)
+		return false;
+	// above the limit in /proc/sys/fs/pipe-max-size this fails and the pipe
+	// keeps its default size
+	fcntl(fds[1], F_SETPIPE_SZ, PROCESS_PIPE_SIZE);
+
+	// the process gets the default SIGPIPE handler back from us ignoring it
+	sigset_t pipe_signal;
+	sigemptyset(&pipe_signal);
+	sigaddset(&pipe_signal, SIGPIPE);
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigdefault(&attr, &pipe_signal);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, fds[0], 0);
+	int error = posix_spawnp(&p->pid, argv[0], &actions, &attr, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	close(fds[0]);
+	if (error != 0) {
+		close(fds[1]);
+		return false;
+	}
+	p->fd = fds[1];
+	p->capacity = (size_t)fcntl(fds[1], F_GETPIPE_SZ);
+	return true;
+}
+
+bool write_process_pipe(struct process_pipe *p, const void *data, size_t size)
+{
+	struct iovec iov = {(void *)data, size};
+	while (iov.iov_len > 0) {
+		ssize_t n = vmsplice(p->fd, &iov, 1, SPLICE_F_GIFT);
+		if (n < 0 && errno == EINVAL)
+			n = write(p->fd, iov.iov_base, iov.iov_len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return false;
+		iov.iov_base = (char *)iov.iov_base + n;
+		iov.iov_len -= n;
+	}
+	return true;
+}
+
+// returns the exit code of the process
+int close_process_pipe(struct process_pipe *p)
+{
+	close(p->fd);
+	int status;
+	while (waitpid(p->pid, &status, 0) < 0)
+		if (errno != EINTR)
+			return -1;
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+size_t page_size(void)
+{
+	return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+void *alloc_pages(size_t size)
+{
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return data == MAP_FAILED ? NULL : data;
+}
+
+void free_pages(void *data, size_t size)
+{
+	munmap(data, size);
+}
+
+// a write after the reader exits fails with EPIPE instead of killing us
+void ignore_broken_pipe(void)
+{
+	signal(SIGPIPE, SIG_IGN);
+}
+
+// a stream on what was stdout, stdout itself then goes to stderr so messages
+// don't end up in the data written to the stream
+FILE *take_stdout(void)
+{
+	fflush(stdout);
+	int fd = dup(STDOUT_FILENO);
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+	return fdopen(fd, "wb");
+}
+
 #endif
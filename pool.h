@@ -0,0 +1,220 @@
+// persistent thread pool, every thread has a deque of tasks, it pushes and
+// pops its own at the bottom and idle threads steal from the top of others.
+// the thread that started the pool is thread 0 and runs tasks while it waits
+
+struct task_group {
+	atomic_long pending;
+	atomic_long finishing;	// tasks that may still touch the group
+	event_handle done;	// set when pending reaches 0
+};
+
+struct task {
+	thread_callback *callback;
+	thread_arg arg;
+	struct task_group *group;
+};
+
+struct deque {
+	mutex_handle lock;
+	struct task *tasks;	// ring of size entries
+	int size, top, bottom;
+	atomic_long count;	// bottom - top, so thieves can skip empty deques without locking
+};
+
+static struct {
+	struct deque *deques;
+	int count;	// worker threads + 1
+	thread_handle *threads;
+	semaphore_handle wake;	// posted once per task while workers sleep
+	atomic_long queued;
+	atomic_long sleeping;
+	atomic_long stop;
+} pool;
+
+static THREAD_LOCAL int pool_self;
+static THREAD_LOCAL unsigned pool_random;
+
+static void deque_push(struct deque *d, struct task *t)
+{
+	lock_mutex(d->lock);
+	if (d->bottom - d->top == d->size) {
+		struct task *tasks = malloc(sizeof(struct task) * d->size * 2);
+		for (int i = d->top; i < d->bottom; ++i)
+			tasks[i - d->top] = d->tasks[i % d->size];
+		free(d->tasks);
+		d->tasks = tasks;
+		d->bottom -= d->top;
+		d->top = 0;
+		d->size *= 2;
+	}
+	d->tasks[d->bottom++ % d->size] = *t;
+	atomic_write(&d->count, d->bottom - d->top);
+	unlock_mutex(d->lock);
+}
+
+static bool deque_take(struct deque *d, struct task *t, bool steal)
+{
+	if (atomic_read(&d->count) == 0)
+		return false;
+	lock_mutex(d->lock);
+	bool result = d->bottom > d->top;
+	if (result)
+		*t = steal ? d->tasks[d->top++ % d->size] : d->tasks[--d->bottom % d->size];
+	if (d->top == d->bottom)
+		d->top = d->bottom = 0;
+	atomic_write(&d->count, d->bottom - d->top);
+	unlock_mutex(d->lock);
+	return result;
+}
+
+// own deque first, then the others starting from a random one
+static bool pool_take(struct task *t)
+{
+	bool found = deque_take(&pool.deques[pool_self], t, false);
+	pool_random = pool_random * 1103515245 + 12345;
+	int start = (int)(pool_random >> 16);
+	for (int k = 0; k < pool.count && !found; ++k) {
+		int victim = (start + k) % pool.count;
+		found = victim != pool_self && deque_take(&pool.deques[victim], t, true);
+	}
+	if (found)
+		interlocked_decrement(&pool.queued);
+	return found;
+}
+
+static void pool_run(struct task *t)
+{
+	struct task_group *group = t->group;
+	t->callback(t->arg);
+	interlocked_increment(&group->finishing);
+	if (interlocked_decrement(&group->pending) == 0)
+		set_event(group->done);
+	interlocked_decrement(&group->finishing);
+}
+
+// yields before sleeping, a burst of small tasks would otherwise put the
+// workers to sleep and wake them again between every task
+#define POOL_SPIN 4
+
+static void pool_worker(void *arg)
+{
+	pool_self = (int)(size_t)arg;
+	pool_random = pool_self;
+	int idle = 0;
+	for (;;) {
+		struct task t;
+		if (pool_take(&t)) {
+			pool_run(&t);
+			idle = 0;
+			continue;
+		}
+		if (atomic_read(&pool.stop))
+			return;
+		if (idle++ < POOL_SPIN) {
+			yield_thread();
+			continue;
+		}
+		// a push counts the task before it looks for sleepers, so either it
+		// sees this worker or this worker sees the task. extra posts only
+		// cause a spurious wake
+		interlocked_increment(&pool.sleeping);
+		if (atomic_read(&pool.queued) == 0 && !atomic_read(&pool.stop))
+			wait_for_semaphore(pool.wake);
+		interlocked_decrement(&pool.sleeping);
+		idle = 0;
+	}
+}
+
+static void pool_start(int threads)
+{
+	pool.count = threads + 1;
+	pool.deques = malloc(sizeof(struct deque) * pool.count);
+	for (int i = 0; i < pool.count; ++i) {
+		pool.deques[i].lock = create_mutex();
+		pool.deques[i].size = 64;
+		pool.deques[i].tasks = malloc(sizeof(struct task) * 64);
+		pool.deques[i].top = pool.deques[i].bottom = 0;
+		atomic_write(&pool.deques[i].count, 0);
+	}
+	pool.wake = create_semaphore();
+	pool.threads = malloc(sizeof(thread_handle) * threads);
+	for (int i = 0; i < threads; ++i)
+		pool.threads[i] = create_thread(pool_worker, (thread_arg)(size_t)(i + 1));
+}
+
+static void pool_stop(void)
+{
+	atomic_write(&pool.stop, 1);
+	for (int i = 0; i < pool.count - 1; ++i)
+		post_semaphore(pool.wake);
+	wait_for_multiple_threads(pool.threads, pool.count - 1);
+	for (int i = 0; i < pool.count - 1; ++i)
+		close_thread(pool.threads[i]);
+	free(pool.threads);
+}
+
+static void pool_group(struct task_group *group)
+{
+	atomic_write(&group->pending, 0);
+	atomic_write(&group->finishing, 0);
+	group->done = create_event();
+	set_event(group->done);
+}
+
+// tasks can be submitted from any thread, including from inside a task
+static void pool_submit(struct task_group *group, thread_callback *callback, thread_arg arg)
+{
+	struct task t = {callback, arg, group};
+	interlocked_increment(&group->pending);
+	reset_event(group->done);
+	deque_push(&pool.deques[pool_self], &t);
+	// workers that are awake may be busy with a task that never returns to
+	// the deque, as run_jobs' are, so any sleeper is woken
+	interlocked_increment(&pool.queued);
+	if (atomic_read(&pool.sleeping) > 0)
+		post_semaphore(pool.wake);
+}
+
+// run queued tasks until every task of the group has finished
+static void pool_wait(struct task_group *group)
+{
+	while (atomic_read(&group->pending) > 0) {
+		struct task t;
+		if (pool_take(&t))
+			pool_run(&t);
+		else
+			wait_for_event(group->done);
+	}
+	// the last task may still be setting the event
+	while (atomic_read(&group->finishing) > 0)
+		yield_thread();
+	close_event(group->done);
+}
+
+struct pool_for_arg {
+	void (*body)(void *, int);
+	void *arg;
+	int begin, end;
+};
+
+static void pool_for_callback(void *arg_)
+{
+	struct pool_for_arg *arg = (struct pool_for_arg *)arg_;
+	for (int i = arg->begin; i < arg->end; ++i)
+		arg->body(arg->arg, i);
+}
+
+// body(arg, i) for every i in [0, count), grain indices to a task
+static void pool_for(int count, int grain, void (*body)(void *, int), void *arg)
+{
+	int tasks = (count + grain - 1) / grain;
+	struct pool_for_arg *args = malloc(sizeof(struct pool_for_arg) * MAX(1, tasks));
+	struct task_group group;
+	pool_group(&group);
+	for (int k = 0; k < tasks; ++k) {
+		args[k] = (struct pool_for_arg){body, arg, k * grain, MIN(count, (k + 1) * grain)};
+		pool_submit(&group, pool_for_callback, &args[k]);
+	}
+	pool_wait(&group);
+	free(args);
+}
@@ -3,6 +3,8 @@ echo **dependencies**: `ffmpeg.exe` in your `PATH`, visual studio build tools
 echo.
 echo **compile**: open an x64 Visual Studio command prompt, cd into the working directory and run `build`
 echo.
+echo **library**: `build` also makes `attractor.lib`, the search and render code without the command line, see `attractor.h`
+echo.
 echo ```
 echo ^>.\main.exe
 main
@@ -0,0 +1,529 @@
+// where the frames of a video go. workers encode each frame into a slot with
+// encode_frame, then a single writer hands the slots to the sink in order
+
+// planar bt.601 limited range yuv, the same as ffmpeg's rgb24 conversion.
+// 4:2:0 averages the rgb of each 2x2 block before converting it, 4:4:4 keeps
+// every pixel. the rows are plain loops over bytes so they vectorise
+static size_t yuv_size(int width, int height, bool full_chroma)
+{
+	int cw = full_chroma ? width : (width + 1) / 2, ch = full_chroma ? height : (height + 1) / 2;
+	return (size_t)width * height + (size_t)cw * ch * 2;
+}
+
+static void rgb_to_yuv(const unsigned char *rgb, int width, int height, bool full_chroma, unsigned char *yuv)
+{
+	int cw = full_chroma ? width : (width + 1) / 2, ch = full_chroma ? height : (height + 1) / 2;
+	unsigned char *y_plane = yuv, *u_plane = yuv + width * height, *v_plane = u_plane + cw * ch;
+
+	for (int i = 0; i < height; ++i) {
+		const unsigned char *p = rgb + (size_t)i * width * 3;
+		unsigned char *y = y_plane + (size_t)i * width;
+		for (int j = 0; j < width; ++j)
+			y[j] = (unsigned char)(((66 * p[3 * j] + 129 * p[3 * j + 1] + 25 * p[3 * j + 2] + 128) >> 8) + 16);
+	}
+
+	for (int i = 0; i < ch; ++i) {
+		unsigned char *u = u_plane + (size_t)i * cw, *v = v_plane + (size_t)i * cw;
+		if (full_chroma) {
+			const unsigned char *p = rgb + (size_t)i * width * 3;
+			for (int j = 0; j < cw; ++j) {
+				int r = p[3 * j], g = p[3 * j + 1], b = p[3 * j + 2];
+				u[j] = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+				v[j] = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+			}
+			continue;
+		}
+		// the last row and column repeat when the size is odd
+		const unsigned char *p0 = rgb + (size_t)(2 * i) * width * 3;
+		const unsigned char *p1 = rgb + (size_t)MIN(2 * i + 1, height - 1) * width * 3;
+		for (int j = 0; j < cw; ++j) {
+			int a = 6 * j, b = 3 * MIN(2 * j + 1, width - 1);
+			int r = (p0[a] + p0[b] + p1[a] + p1[b] + 2) >> 2;
+			int g = (p0[a + 1] + p0[b + 1] + p1[a + 1] + p1[b + 1] + 2) >> 2;
+			int bl = (p0[a + 2] + p0[b + 2] + p1[a + 2] + p1[b + 2] + 2) >> 2;
+			u[j] = (unsigned char)(((-38 * r - 74 * g + 112 * bl + 128) >> 8) + 128);
+			v[j] = (unsigned char)(((112 * r - 94 * g - 18 * bl + 128) >> 8) + 128);
+		}
+	}
+}
+
+struct video_sink {
+	enum sink_type type;
+	int width, height, fps;
+	bool full_chroma;	// yuv444p instead of yuv420p
+	int quality;	// of AVI's jpegs
+	bool delta;	// APNG frames only cover what changed
+	int length;	// frames in the video, APNG needs it up front
+	char name[256];	// file written to, or what IMAGES numbers its files after
+	struct process_pipe pipe;	// FFMPEG
+	FILE *file;	// Y4M, YUV, RGB, AVI and APNG
+	unsigned sequence;	// APNG, of the next fcTL or fdAT chunk
+	unsigned *chunk_sizes;	// AVI, for the index written at the end
+	long long movi_size;	// AVI, bytes of chunks so far
+	size_t largest;	// AVI
+	size_t capacity;	// bytes written after a frame that the sink may still read it from its slot
+	int frames;
+	long long bytes;
+	double seconds;	// spent in write_sink and close_sink
+};
+
+// what -out - writes to, taken before anything is printed
+static FILE *video_stdout;
+
+// riff is little endian, a chunk is an id, the size of its data and the data
+// padded to an even size. a list is a chunk whose data starts with its type
+static void put_u16(FILE *f, unsigned v)
+{
+	unsigned char b[2] = {(unsigned char)v, (unsigned char)(v >> 8)};
+	fwrite(b, 2, 1, f);
+}
+
+static void put_u32(FILE *f, unsigned v)
+{
+	unsigned char b[4] = {(unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24)};
+	fwrite(b, 4, 1, f);
+}
+
+static void put_chunk(FILE *f, const char *id, unsigned size)
+{
+	fwrite(id, 4, 1, f);
+	put_u32(f, size);
+}
+
+// everything before the first frame, it's written again with the totals
+// once the frames are. the movi list's data starts at AVI_HEADER - 4
+#define AVI_HEADER 224
+#define AVI_KEYFRAME 0x10
+#define AVI_HAS_INDEX 0x10
+// sizes are 32 bits and plenty of readers take them as signed
+#define AVI_LIMIT 0x7fffffffLL
+
+static void write_avi_header(struct video_sink *s)
+{
+	FILE *f = s->file;
+	long long index = 8 + 16LL * s->frames;
+	put_chunk(f, "RIFF", (unsigned)(AVI_HEADER - 8 + s->movi_size + index));
+	fwrite("AVI ", 4, 1, f);
+	put_chunk(f, "LIST", 4 + 64 + 12 + 64 + 48);
+	fwrite("hdrl", 4, 1, f);
+
+	put_chunk(f, "avih", 56);
+	put_u32(f, 1000000 / s->fps);
+	put_u32(f, (unsigned)(s->largest * s->fps));
+	put_u32(f, 0);
+	put_u32(f, AVI_HAS_INDEX);
+	put_u32(f, s->frames);
+	put_u32(f, 0);
+	put_u32(f, 1);	// streams
+	put_u32(f, (unsigned)s->largest);
+	put_u32(f, s->width);
+	put_u32(f, s->height);
+	for (int i = 0; i < 4; ++i)
+		put_u32(f, 0);
+
+	put_chunk(f, "LIST", 4 + 64 + 48);
+	fwrite("strl", 4, 1, f);
+	put_chunk(f, "strh", 56);
+	fwrite("vidsMJPG", 8, 1, f);
+	put_u32(f, 0);	// flags
+	put_u32(f, 0);	// priority and language
+	put_u32(f, 0);	// initial frames
+	put_u32(f, 1);	// the rate is frames per second
+	put_u32(f, s->fps);
+	put_u32(f, 0);	// start
+	put_u32(f, s->frames);
+	put_u32(f, (unsigned)s->largest);
+	put_u32(f, 0xffffffff);	// default quality
+	put_u32(f, 0);	// frames vary in size
+	put_u16(f, 0);
+	put_u16(f, 0);
+	put_u16(f, s->width);
+	put_u16(f, s->height);
+
+	// a bitmapinfoheader
+	put_chunk(f, "strf", 40);
+	put_u32(f, 40);
+	put_u32(f, s->width);
+	put_u32(f, s->height);
+	put_u16(f, 1);	// planes
+	put_u16(f, 24);	// bits per pixel
+	fwrite("MJPG", 4, 1, f);
+	put_u32(f, s->width * s->height * 3);
+	for (int i = 0; i < 4; ++i)
+		put_u32(f, 0);
+
+	put_chunk(f, "LIST", (unsigned)(4 + s->movi_size));
+	fwrite("movi", 4, 1, f);
+}
+
+// the index has each frame's offset from the start of the movi list's data
+static bool write_avi_index(struct video_sink *s)
+{
+	FILE *f = s->file;
+	put_chunk(f, "idx1", 16 * s->frames);
+	long long offset = 4;
+	for (int i = 0; i < s->frames; ++i) {
+		fwrite("00dc", 4, 1, f);
+		put_u32(f, AVI_KEYFRAME);
+		put_u32(f, (unsigned)offset);
+		put_u32(f, s->chunk_sizes[i]);
+		offset += 8 + (s->chunk_sizes[i] + 1) / 2 * 2;
+	}
+	if (fseek(f, 0, SEEK_SET) != 0)
+		return false;
+	write_avi_header(s);
+	return !ferror(f);
+}
+
+// png chunks are big endian, a length, a type, the data and the crc of the
+// type and the data
+static void put_u32_be(unsigned char *p, unsigned v)
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+static unsigned get_u32_be(const unsigned char *p)
+{
+	return (unsigned)p[0] << 24 | (unsigned)p[1] << 16 | (unsigned)p[2] << 8 | p[3];
+}
+
+// type_data is the type followed by the data, the crc is written after it
+static bool write_png_chunk(FILE *f, unsigned char *type_data, unsigned size)
+{
+	unsigned char b[4];
+	put_u32_be(b, size);
+	bool result = fwrite(b, 4, 1, f) == 1 && fwrite(type_data, 4 + size, 1, f) == 1;
+	put_u32_be(b, stbiw__crc32(type_data, 4 + size));
+	return result && fwrite(b, 4, 1, f) == 1;
+}
+
+// an apng frame in its slot, followed by the zlib stream of its rectangle.
+// the writer fills chunk in just before the data with the length, type and
+// sequence number of its fdAT, or the length and type of an IDAT, so the
+// chunk is written and its crc found without copying the data
+struct apng_frame {
+	unsigned x, y, width, height;
+	unsigned char chunk[12];
+};
+
+// the rectangle of the frame that differs from previous, at least a pixel
+static void changed_rect(const unsigned char *rgb, const unsigned char *previous, int width, int height,
+                         struct apng_frame *f)
+{
+	size_t row = (size_t)width * 3;
+	int top = 0, bottom = height;
+	while (top < height && 0 == memcmp(rgb + top * row, previous + top * row, row))
+		++top;
+	while (bottom > top && 0 == memcmp(rgb + (bottom - 1) * row, previous + (bottom - 1) * row, row))
+		--bottom;
+	int left = width, right = 0;
+	for (int i = top; i < bottom; ++i) {
+		const unsigned char *a = rgb + i * row, *b = previous + i * row;
+		int j = 0;
+		while (j < left && 0 == memcmp(a + 3 * j, b + 3 * j, 3))
+			++j;
+		left = MIN(left, j);
+		j = width;
+		while (j > right && 0 == memcmp(a + 3 * (j - 1), b + 3 * (j - 1), 3))
+			--j;
+		right = MAX(right, j);
+	}
+	if (top == bottom) {
+		*f = (struct apng_frame){.x = 0, .y = 0, .width = 1, .height = 1};
+		return;
+	}
+	*f = (struct apng_frame){.x = left, .y = top, .width = right - left, .height = bottom - top};
+}
+
+// stb's png has the zlib stream of the image in its IDAT chunks
+static size_t encode_apng_frame(struct video_sink *s, const unsigned char *rgb, const unsigned char *previous,
+                                unsigned char *out, size_t size)
+{
+	struct apng_frame *f = (struct apng_frame *)out;
+	if (s->delta && previous)
+		changed_rect(rgb, previous, s->width, s->height, f);
+	else
+		*f = (struct apng_frame){.x = 0, .y = 0, .width = s->width, .height = s->height};
+
+	int len;
+	const unsigned char *pixels = rgb + ((size_t)f->y * s->width + f->x) * 3;
+	unsigned char *png = stbi_write_png_to_mem(pixels, s->width * 3, f->width, f->height, 3, &len);
+	if (png == NULL)
+		return 0;
+	size_t result = sizeof(struct apng_frame);
+	for (int p = 8; p + 12 <= len; ) {
+		unsigned chunk = get_u32_be(png + p);
+		if (0 == memcmp(png + p + 4, "IDAT", 4)) {
+			if (result + chunk > size) {
+				result = 0;
+				break;
+			}
+			memcpy(out + result, png + p + 8, chunk);
+			result += chunk;
+		}
+		p += 12 + chunk;
+	}
+	STBIW_FREE(png);
+	return result;
+}
+
+static bool write_apng_header(struct video_sink *s)
+{
+	FILE *f = s->file;
+	bool result = fwrite("\x89PNG\r\n\x1a\n", 8, 1, f) == 1;
+	unsigned char ihdr[4 + 13] = "IHDR";
+	put_u32_be(ihdr + 4, s->width);
+	put_u32_be(ihdr + 8, s->height);
+	ihdr[12] = 8;	// bits per channel
+	ihdr[13] = 2;	// rgb
+	result = result && write_png_chunk(f, ihdr, 13);
+	// plays forever
+	unsigned char actl[4 + 8] = "acTL";
+	put_u32_be(actl + 4, s->length);
+	put_u32_be(actl + 8, 0);
+	return result && write_png_chunk(f, actl, 8);
+}
+
+// the first frame is the default image, so it's in IDAT chunks
+static bool write_apng_frame(struct video_sink *s, unsigned char *frame, size_t size)
+{
+	struct apng_frame *f = (struct apng_frame *)frame;
+	unsigned data = (unsigned)(size - sizeof(struct apng_frame));
+	unsigned char fctl[4 + 26] = "fcTL";
+	put_u32_be(fctl + 4, s->sequence++);
+	put_u32_be(fctl + 8, f->width);
+	put_u32_be(fctl + 12, f->height);
+	put_u32_be(fctl + 16, f->x);
+	put_u32_be(fctl + 20, f->y);
+	// a delay of 1 / fps, the rest of the frame is kept from the one before
+	fctl[24] = 0;
+	fctl[25] = 1;
+	fctl[26] = (unsigned char)(s->fps >> 8);
+	fctl[27] = (unsigned char)s->fps;
+	fctl[28] = 0;	// dispose none
+	fctl[29] = 0;	// blend source
+	if (!write_png_chunk(s->file, fctl, 26))
+		return false;
+
+	if (s->frames == 0) {
+		memcpy(f->chunk + 8, "IDAT", 4);
+		return write_png_chunk(s->file, f->chunk + 8, data);
+	}
+	memcpy(f->chunk + 4, "fdAT", 4);
+	put_u32_be(f->chunk + 8, s->sequence++);
+	return write_png_chunk(s->file, f->chunk + 4, 4 + data);
+}
+
+// most bytes encode_frame can make of a frame
+static size_t frame_bound(struct video_sink *s)
+{
+	switch (s->type) {
+		case SINK_RGB:
+			return (size_t)s->width * s->height * 3;
+		case SINK_IMAGES:
+			return attractor_png_bound(s->width, s->height);
+		case SINK_AVI:
+			return attractor_jpg_bound(s->width, s->height);
+		case SINK_APNG:
+			return sizeof(struct apng_frame) + attractor_png_bound(s->width, s->height);
+		default:
+			return yuv_size(s->width, s->height, s->full_chroma);
+	}
+}
+
+// returns the size of the encoded frame, 0 if it didn't fit in size bytes.
+// previous is the frame before it if it's at hand, or NULL
+static size_t encode_frame(struct video_sink *s, const unsigned char *rgb, const unsigned char *previous,
+                           unsigned char *out, size_t size)
+{
+	switch (s->type) {
+		case SINK_RGB:
+			memcpy(out, rgb, frame_bound(s));
+			return frame_bound(s);
+		case SINK_IMAGES:
+			return attractor_encode_png(rgb, s->width, s->height, out, size);
+		case SINK_AVI:
+			return attractor_encode_jpg(rgb, s->width, s->height, s->quality, out, size);
+		case SINK_APNG:
+			return encode_apng_frame(s, rgb, previous, out, size);
+		default:
+			rgb_to_yuv(rgb, s->width, s->height, s->full_chroma, out);
+			return frame_bound(s);
+	}
+}
+
+static void open_sink(struct video_sink *s)
+{
+	char *ext[] = {
+		[SINK_FFMPEG] = "out.mp4",
+		[SINK_Y4M] = "out.y4m",
+		[SINK_YUV] = "out.yuv",
+		[SINK_RGB] = "out.rgb",
+		[SINK_IMAGES] = "frame",
+		[SINK_AVI] = "out.avi",
+		[SINK_APNG] = "out.png",
+	};
+	if (OUT)
+		snprintf(s->name, sizeof(s->name), "%s", OUT);
+	else
+		snprintf(s->name, sizeof(s->name), "%s%s", OUT_DIR, ext[s->type]);
+	s->capacity = 0;
+
+	switch (s->type) {
+		case SINK_FFMPEG:
+		{
+			// frames are converted before they go down the pipe, lossless keeps
+			// full chroma as x264 would have picked yuv444p for rgb input
+			char size[32], rate[16];
+			snprintf(size, sizeof(size), "%dx%d", s->width, s->height);
+			snprintf(rate, sizeof(rate), "%d", s->fps);
+			char *LOSSY_OPTS[] = {"-crf", "17", NULL};
+			char *LOSSLESS_OPTS[] = {"-qp", "0", "-preset", "veryslow", NULL};
+			char *argv[32] = {
+				"ffmpeg", "-loglevel", "error", "-y",
+				"-f", "rawvideo", "-pix_fmt", s->full_chroma ? "yuv444p" : "yuv420p",
+				"-s", size, "-r", rate, "-i", "-",
+				"-c:v", "libx264",
+			};
+			int a = 16;
+			for (char **o = s->full_chroma ? LOSSLESS_OPTS : LOSSY_OPTS; *o; ++o)
+				argv[a++] = *o;
+			argv[a++] = s->name;
+			if (!open_process_pipe(&s->pipe, argv)) {
+				fprintf(stderr, "could not start ffmpeg\n");
+				exit(1);
+			}
+			s->capacity = s->pipe.capacity;
+		} break;
+		case SINK_Y4M:
+		case SINK_YUV:
+		case SINK_RGB:
+			s->file = 0 == strcmp(s->name, "-") ? video_stdout : fopen(s->name, "wb");
+			if (s->file == NULL) {
+				fprintf(stderr, "could not open %s\n", s->name);
+				exit(1);
+			}
+			// the chroma of 4:2:0 is the average of each 2x2 block, so it's
+			// sited in the middle of them like jpeg's
+			if (s->type == SINK_Y4M)
+				fprintf(s->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 %s XCOLORRANGE=LIMITED\n",
+				        s->width, s->height, s->fps, s->full_chroma ? "C444" : "C420jpeg");
+			break;
+		case SINK_AVI:
+			s->file = fopen(s->name, "wb");
+			if (s->file == NULL) {
+				fprintf(stderr, "could not open %s\n", s->name);
+				exit(1);
+			}
+			s->chunk_sizes = NULL;
+			s->movi_size = 0;
+			s->largest = 0;
+			write_avi_header(s);
+			break;
+		case SINK_APNG:
+			s->file = 0 == strcmp(s->name, "-") ? video_stdout : fopen(s->name, "wb");
+			if (s->file == NULL || !write_apng_header(s)) {
+				fprintf(stderr, "could not open %s\n", s->name);
+				exit(1);
+			}
+			s->sequence = 0;
+			break;
+		default:
+			break;
+	}
+}
+
+// the frame is the writer's until it's written, APNG fills in its chunk
+static void write_sink(struct video_sink *s, unsigned char *frame, size_t size)
+{
+	double start = wall_time();
+	bool result;
+	switch (s->type) {
+		case SINK_FFMPEG:
+			if (!write_process_pipe(&s->pipe, frame, size)) {
+				fprintf(stderr, "\nffmpeg stopped reading frames\n");
+				exit(1);
+			}
+			result = true;
+			break;
+		case SINK_IMAGES:
+		{
+			char name[256 + 16];
+			snprintf(name, sizeof(name), "%s%05d.png", s->name, s->frames);
+			FILE *f = fopen(name, "wb");
+			result = f && fwrite(frame, size, 1, f) == 1;
+			if (f)
+				result = fclose(f) == 0 && result;
+		} break;
+		case SINK_AVI:
+		{
+			long long chunk = 8 + (size + 1) / 2 * 2;
+			if (AVI_HEADER + s->movi_size + chunk + 8 + 16LL * (s->frames + 1) > AVI_LIMIT) {
+				fprintf(stderr, "\n%s would be over 2GB, use fewer frames or a lower -jpeg-quality\n", s->name);
+				exit(1);
+			}
+			// the index grows in powers of two
+			if ((s->frames & (s->frames - 1)) == 0)
+				s->chunk_sizes = realloc(s->chunk_sizes, sizeof(unsigned) * MAX(1, 2 * s->frames));
+			s->chunk_sizes[s->frames] = (unsigned)size;
+			s->movi_size += chunk;
+			s->largest = MAX(s->largest, size);
+			put_chunk(s->file, "00dc", (unsigned)size);
+			result = fwrite(frame, size, 1, s->file) == 1 && (size % 2 == 0 || fputc(0, s->file) != EOF);
+		} break;
+		case SINK_APNG:
+			result = write_apng_frame(s, frame, size);
+			break;
+		default:
+			result = (s->type != SINK_Y4M || fputs("FRAME\n", s->file) >= 0) && fwrite(frame, size, 1, s->file) == 1;
+			break;
+	}
+	if (!result) {
+		fprintf(stderr, "\ncould not write frame %d to %s\n", s->frames, s->name);
+		exit(1);
+	}
+	++s->frames;
+	s->bytes += size;
+	s->seconds += wall_time() - start;
+}
+
+// waits for the sink to take every frame, so slots can be freed after it
+static void close_sink(struct video_sink *s)
+{
+	double start = wall_time();
+	bool result = true;
+	switch (s->type) {
+		case SINK_FFMPEG:
+			result = close_process_pipe(&s->pipe) == 0;
+			break;
+		case SINK_IMAGES:
+			break;
+		case SINK_AVI:
+			result = write_avi_index(s);
+			result = fclose(s->file) == 0 && result;
+			free(s->chunk_sizes);
+			break;
+		case SINK_APNG:
+		{
+			unsigned char iend[4] = "IEND";
+			result = write_png_chunk(s->file, iend, 0);
+			result = fclose(s->file) == 0 && result;
+		} break;
+		default:
+			result = fclose(s->file) == 0;
+			break;
+	}
+	s->seconds += wall_time() - start;
+	if (!result) {
+		fprintf(stderr, "%s failed\n", s->type == SINK_FFMPEG ? "ffmpeg" : "writing video");
+		return;
+	}
+
+	double seconds = MAX(s->seconds, 1e-6);
+	printf("wrote %d frames to %s%s, %.1f MB, the sink took %.3fs, %.1f fps, %.1f MB/s\n",
+	       s->frames, s->name, s->type == SINK_IMAGES ? "*.png" : "", s->bytes / 1e6, s->seconds,
+	       s->frames / seconds, s->bytes / 1e6 / seconds);
+}